@@ -1,31 +1,111 @@
+#ifndef _WIN32
+#define _DEFAULT_SOURCE // POSIX and BSD declarations (S_ISSOCK, clock_gettime, usleep) under -std=c11 as well
+#endif
 #include <stdio.h>   // for standard input-output{printf, fprintf, fscanf, fread, fwrite, fclose, fopen, fflush, perror}
-#include <stdlib.h>  // for randomization, runing os commands, quit programs with code{ abs, rand, srand, exit, system}
-#include <time.h>    // for generating random number with real time (time)
+#include <stdlib.h>  // for runing os commands, quit programs with code{ abs, exit, system, strtoull}
+#include <time.h>    // for seeding the random generator with real time (time)
 #include <stdbool.h> // for boolean function
 #include <string.h>  // for string functions {strlen, strncpy, strcmp, strrchr, strcspn, memcopy}
 #include <ctype.h>   // for Character handling
+#include <errno.h>   // for error codes {errno, EINTR}
+#include <stdarg.h>  // for variable argument lists {va_list, va_start, va_end, vsnprintf}
+#include <stdint.h>  // for fixed-width integers used by the random generator {uint32_t, uint64_t}
+#include <stdatomic.h> // for the compaction thread's finished flag {atomic_bool, atomic_load, atomic_store}
 
 // Platform-specific headers
 #ifdef _WIN32
 #include <conio.h>   // Including standard and platform-specific libraries
 #include <windows.h> // Including standard and platform-specific libraries
 #include <direct.h>  // Including standard and platform-specific libraries
+#include <io.h>      // for flushing files to disk {_commit, _fileno}
 // #define getch _getch
 #else
 #include <termios.h>   // for controlling terminal I/O behavior (input/output settings)
 #include <unistd.h>    // program to talk directly to the OS (files, processes, environment) in Unix/Linux
 #include <sys/ioctl.h> // for low-level device control like getting terminal size, modes
 #include <sys/stat.h>  // for file and directory information & management.
+#include <poll.h>      // for waiting on terminal input without blocking {poll}
+#include <signal.h>    // for restoring the terminal on fatal signals {sigaction, raise}
+#include <pthread.h>   // for simulator, compaction and autosave threads {pthread_create, pthread_join, pthread_cond_wait}
+#include <sys/mman.h>  // for reading save files in place {mmap, munmap}
+#include <fcntl.h>     // for opening files to map {open}
+#include <sys/socket.h>  // for the spectator server {socket, bind, listen, accept, send}
+#include <sys/un.h>      // for Unix socket addresses {sockaddr_un}
+#include <netinet/in.h>  // for TCP addresses {sockaddr_in, htons, htonl}
+#include <netinet/tcp.h> // for sending spectator frames without delay {TCP_NODELAY}
+#ifdef __linux__
+#include <sys/epoll.h>   // for the spectator broadcaster {epoll_create1, epoll_ctl, epoll_wait}
+#include <sys/eventfd.h> // for waking the broadcaster after a frame {eventfd}
+#endif
 #endif
 
 // Game constants
-#define MAP_WIDTH 40              // Game constant definition
-#define MAP_HEIGHT 12             // Game constant definition
-#define MAX_ENEMIES 25            // Game constant definition
-#define MAX_LEADERBOARD 10        // Game constant definition
-#define MSG_LINE_1 MAP_HEIGHT + 2 // Game constant definition
-#define MSG_LINE_2 MAP_HEIGHT + 3 // Game constant definition
-#define MSG_LINE_3 MAP_HEIGHT + 4 // Game constant definition
+#define DEFAULT_MAP_WIDTH 40      // Map size unless --map-width / --map-height say otherwise
+#define DEFAULT_MAP_HEIGHT 12     // Game constant definition
+#define DEFAULT_MAX_ENEMIES 25    // Spawn cap unless --max-enemies says otherwise (the pool itself grows)
+#define MIN_MAP_WIDTH 16          // Room for the boss room and the spawn exclusion band
+#define MIN_MAP_HEIGHT 8          // Game constant definition
+#define MAX_MAP_SIZE 65535        // Largest width or height; saves store them as 16 bits
+#define MAX_ROW_WORDS ((MAX_MAP_SIZE + 63) / 64) // 64-cell words in the widest row bitmask
+#define ENEMY_POOL_MIN_CAPACITY 32 // First allocation of the enemy pool
+#define MAX_ENEMIES 1000000        // Largest --max-enemies, and the most enemies a save may hold
+#define ROWS_AHEAD 16             // Scroll rows generated per batch ahead of the scroll front
+#define ARENA_ALIGN 64            // Alignment of every arena allocation (one cache line)
+#define FLOW_MAX_STEPS 16         // Flow field search depth; chasers are at most 10 steps off in open ground
+#define CHUNK_ROWS 64             // World rows per history chunk (one presence bit each)
+#define CHUNK_PREFETCH_ROWS 16    // Load the next chunk once the map edge is this many rows from it
+#define DEFAULT_CHUNK_BUDGET_KB 256 // Resident history memory unless --chunk-budget says otherwise
+#define MAX_LEADERBOARD 10        // Rows shown on the leaderboard screen (the store keeps every player)
+#define LEADERBOARD_VERSION 1     // Bumped whenever the leaderboard file layout changes
+#define LEADERBOARD_COMPACT_RECORDS 256 // Journal records that trigger a background compaction
+#define SAVE_VERSION 4              // Save format version; 1 was the raw GameData struct, 2 had 8-bit map sizes, 3 no history
+#define SAVE_HEADER_SIZE 16         // Magic, version, payload length, checksum
+#define AUTOSAVE_TURNS 50           // Turns between autosaves unless --autosave says otherwise
+#define LEADERBOARD_RECORD_MAX (1 + 49 + 8 + 4) // Largest journal record: name length, name, level, distance, checksum
+#define LEADERBOARD_RECORD_MIN (1 + 1 + 8)      // Smallest snapshot record: name length, one-letter name, level, distance
+#define LEADERBOARD_MAX_ENTRIES (1 << 28)       // Keeps the entry and name table sizes within an int
+#define MSG_LINE_1 (view.height + 2) // Message lines sit below the viewport
+#define MSG_LINE_2 (view.height + 3) // Game constant definition
+#define MSG_LINE_3 (view.height + 4) // Game constant definition
+#define MESSAGE_LINES 3              // Timed message slots, one per message line
+#define HEADLESS_DEFAULT_TURNS 100000 // Turn cap for headless runs without --turns
+#define SIM_DISTANCE_BUCKETS 8192     // Simulator distance histogram; farther runs land in the last bucket
+#define SIM_MAX_LEVEL 64              // Simulator level histogram size
+#define SIM_MAX_THREADS 256           // Upper bound on simulator worker threads
+#define REPLAY_VERSION 4              // Bumped whenever the replay layout changes
+#define REPLAY_KEYFRAME_INTERVAL 1000 // Turns between keyframes unless --keyframe-interval says otherwise
+#define REPLAY_KEYFRAME_TAG 'K'       // Record byte that starts a keyframe; turns are 'w', 'a', 's', 'd', ' ' or 't'
+#define DEFAULT_FRAME_RATE 30         // Frames drawn per second in --realtime mode unless --fps says otherwise
+#define MAX_TICK_CATCHUP 4            // Ticks run back to back after a stall; any further behind are dropped
+#define TIMING_BUCKETS 10000          // Tick and frame timing histogram, 10 us per bucket (100 ms range)
+#define TIMING_BUCKET_SECONDS 0.00001 // Game constant definition
+#define PROFILE_SUB_BITS 5            // Profiler histograms keep 32 buckets per power of two (about 3%)
+#define PROFILE_BUCKETS ((65 - PROFILE_SUB_BITS) << PROFILE_SUB_BITS) // Enough for any 64-bit nanosecond count
+#define PROFILE_MAX_DEPTH 16          // Nested profiled phases tracked; deeper ones are not recorded
+#define BENCH_SEED 1                  // Every benchmark case starts from this seed
+#define BENCH_BATCHES 5               // Timed batches per case; the median and fastest are reported
+#define BENCH_BATCH_SECONDS 0.01      // Batches are grown until one takes at least this long
+#define BENCH_SAVE_PATH "bench_save.tmp"               // Scratch files of the file round-trip cases
+#define BENCH_LEADERBOARD_PATH "bench_leaderboard.tmp" // Game constant definition
+#define SPECTATOR_MAX_CLIENTS 64      // Spectators connected at once; more are turned away
+#define SPECTATOR_MAX_BACKLOG 1048576 // Bytes a spectator may fall behind before it is sent a full frame instead
+
+// Renderer constants
+#define MIN_SCREEN_WIDTH 80            // HUD width; the screen is at least this wide
+#define MAX_SCREEN_WIDTH 256           // Frame buffer capacity in cells
+#define MAX_SCREEN_HEIGHT 128          // Renderer constant definition
+#define HUD_LINES 6                    // HUD and message lines below the viewport
+#define DEFAULT_TERMINAL_WIDTH 80      // Assumed when the terminal size cannot be read
+#define DEFAULT_TERMINAL_HEIGHT 24     // Renderer constant definition
+#define OUTPUT_BUFFER_SIZE 65536       // Bytes batched before a single write()
+#define FILE_SINK_BUFFER_SIZE 1048576  // stdio buffer used by the file sink
+
+// Input constants
+#define INPUT_QUEUE_SIZE 256 // Decoded key events waiting to be handled
+#define KEY_UP 0x100         // Arrow keys decode past the byte range
+#define KEY_DOWN 0x101       // Input constant definition
+#define KEY_RIGHT 0x102      // Input constant definition
+#define KEY_LEFT 0x103       // Input constant definition
 
 // Game state enumeration
 typedef enum
@@ -38,6 +118,78 @@ typedef enum
 } GameState;
 // Different states of the game (menu, playing, game over, etc.)
 
+// Cell colors used by the frame renderer (index into color_codes)
+typedef enum
+{
+    COLOR_DEFAULT,
+    COLOR_BOSS_ROOM,
+    COLOR_CYAN,
+    COLOR_BRIGHT_WHITE,
+    COLOR_BRIGHT_YELLOW,
+    COLOR_LIGHT_RED,
+    COLOR_BRIGHT_CYAN,
+    COLOR_BRIGHT_RED,
+    COLOR_GRAY,
+    COLOR_COUNT
+} CellColor;
+
+// Message on one of the message lines; draw_game() keeps drawing it over the HUD until both
+// its time and its turn have passed
+typedef struct
+{
+    char text[64];
+    CellColor color;
+    double until;    // now_seconds() time, 0 = no minimum time
+    long until_turn; // game turn_count, 0 = no minimum turns
+    bool active;
+} TimedMessage;
+
+// One screen cell: the glyph and the color it is drawn with
+typedef struct
+{
+    char glyph;
+    unsigned char color;
+} ScreenCell;
+
+// Render sink: the backend every byte of screen output is written to
+typedef struct RenderSink RenderSink;
+struct RenderSink
+{
+    const char *name;
+    bool (*write)(RenderSink *sink, const char *data, size_t length);
+    void (*close)(RenderSink *sink);
+    int fd;              // stdout sink
+    FILE *file;          // file sink
+    char *memory;        // memory sink
+    size_t memory_length;
+    size_t memory_capacity;
+    unsigned long long total_bytes;
+    unsigned long long total_flushes;
+    unsigned long long frames;
+    unsigned long long frame_bytes;  // Bytes of the frame being built
+    unsigned long long frame_flushes;
+    unsigned long long last_frame_bytes;
+    unsigned long long last_frame_flushes;
+    unsigned long long max_frame_bytes;
+};
+
+// PCG32 random generator: one independent stream per game system
+typedef struct
+{
+    uint64_t state;
+    uint64_t inc; // Stream selector, always odd
+} Rng;
+
+// Random streams owned by the game, all derived from one seed
+typedef struct
+{
+    uint64_t seed;
+    Rng map;    // generate_row_tiles
+    Rng spawn;  // spawn_enemies
+    Rng ai;     // move_enemies
+    Rng policy; // headless random input
+} GameRandom;
+
 // Player structure
 typedef struct
 {
@@ -61,6 +213,315 @@ typedef struct
     bool is_boss;
 } Enemy;
 
+// Handle to a pooled enemy; stays valid until that enemy is removed
+typedef struct
+{
+    int slot;
+    unsigned int generation;
+} EnemyHandle;
+
+// Slot table entry: where a handle's enemy currently sits in the dense array
+typedef struct
+{
+    int dense;               // Index into items, or next free slot when unused
+    unsigned int generation; // Bumped on removal so stale handles stop resolving
+    int next_in_cell;        // Next slot on the same map cell (occupancy grid chain)
+} EnemySlot;
+
+// Enemy pool: live enemies packed in items[0..count) with O(1) swap-remove
+typedef struct
+{
+    Enemy *items;
+    int *slot_of; // items[i] belongs to slots[slot_of[i]]
+    EnemySlot *slots;
+    int count;
+    int capacity;
+    int slot_count;
+    int free_slot; // Head of the free slot list, -1 when empty
+} EnemyPool;
+
+// Headless run configuration
+typedef enum
+{
+    INPUT_RANDOM,
+    INPUT_SCRIPT,
+    INPUT_STDIN
+} HeadlessInput;
+
+typedef struct
+{
+    HeadlessInput input;
+    const char *script_path;
+    long max_turns;
+} HeadlessConfig;
+
+// Balance knobs the simulator can vary; the defaults are the shipped game
+typedef struct
+{
+    float progress_rate;    // Enemy stats grow by 100% every progress_rate rows
+    int boss_hp;            // Boss stats are base + world_offset / rate
+    int boss_hp_rate;
+    int boss_strength;
+    int boss_strength_rate;
+    int boss_xp;
+    int boss_xp_rate;
+    double xp_growth;       // xp_to_level multiplier per level
+} Balance;
+
+// Bump allocator over one block; everything in it is freed together
+typedef struct
+{
+    unsigned char *base;
+    size_t used;
+    size_t capacity;
+} Arena;
+
+// Map size and spawn cap, chosen at startup
+typedef struct
+{
+    int width;
+    int height;
+    int max_enemies;
+} WorldSize;
+
+// Per-cell arrays of one world, all carved from a single arena sized for the map. Rows are
+// width cells (tiles, occupancy, flow) or row_words 64-bit words (bitmasks).
+typedef struct
+{
+    Arena arena;
+    char *map_rows;         // Ring buffer of rows, logical row 0 lives at map_head
+    int *occupancy;         // First enemy slot on each cell (-1 = empty), rows follow map_head
+    uint64_t *walkable;     // Bit x set where the tile is '_', rows follow map_head
+    uint64_t *occupied;     // Bit x set where at least one enemy stands, rows follow map_head
+    uint8_t *flow;          // Steps from each reached cell to the player, logical rows
+    uint64_t *flow_reached; // Cells flow holds a distance for
+    uint64_t *flow_layers;  // Two frontier layers of the search
+    char *rows_ahead;       // ROWS_AHEAD scroll rows already generated, next at ahead_next
+    int *spawn_counts;      // Eligible spawn cells per logical row, rebuilt for each wave
+} MapGrid;
+
+// Growable little-endian byte buffer the save format is written into
+typedef struct
+{
+    unsigned char *data;
+    size_t length;
+    size_t capacity;
+    bool ok; // Cleared when an allocation fails
+} ByteWriter;
+
+// Cursor over save bytes (usually a mapped file); reading past the end clears ok
+typedef struct
+{
+    const unsigned char *data;
+    size_t length;
+    size_t pos;
+    bool ok;
+} ByteReader;
+
+// One resident chunk of world history: world rows id * CHUNK_ROWS .. id * CHUNK_ROWS + CHUNK_ROWS - 1
+typedef struct
+{
+    long id;             // -1 = slot unused
+    uint64_t present;    // Bit i set once row i has been stored
+    bool dirty;          // Rows were added since the chunk was last written
+    unsigned long stamp; // Last use, the least recent slot is evicted first
+    char *rows;          // CHUNK_ROWS rows of width tiles
+} ChunkSlot;
+
+// Where a chunk sits in the data file; one fixed-size record per chunk id in the index file
+typedef struct
+{
+    uint64_t offset;
+    uint32_t length;   // 0 = never written
+    uint32_t capacity; // Bytes reserved at offset; a rewrite that fits stays in place
+} ChunkRecord;
+
+// Rows that scrolled off the map. At most slot_count chunks are held in memory; the least
+// recently used one is written to a temporary file as (run length, tile) pairs when another is
+// needed. The index is a file as well, so memory stays the same however far the player goes.
+// Rows are a pure function of the run's map stream, so anything the store does not hold (after
+// a load or a replay seek, or when the files cannot be written) is generated again.
+typedef struct
+{
+    FILE *data;
+    FILE *index;
+    int width;
+    Rng origin;        // Map stream of the run the rows belong to, before its first row
+    ChunkSlot *slots;
+    int slot_count;
+    unsigned long clock;
+    ByteWriter record; // Encoding buffer, reused
+    unsigned long long loads;      // Chunks read back from disk
+    unsigned long long prefetches; // ... of which ahead of need
+    unsigned long long writes;
+    unsigned long long evictions;
+    unsigned long long rebuilds;   // Rows generated again because no chunk held them
+    unsigned long long bytes_written;
+} ChunkStore;
+
+// Cells of the map on screen; it follows the player
+typedef struct
+{
+    int x;      // Map cell shown in the top-left corner
+    int y;
+    int width;  // Cells shown, at most the map size
+    int height;
+} Viewport;
+
+// All state of one running game; the interactive session and every simulator thread own one
+typedef struct
+{
+    int width;       // Map size, fixed when the grid is allocated
+    int height;
+    int row_words;   // 64-cell words in a row bitmask
+    int max_enemies; // Spawn cap
+    MapGrid grid;
+    int map_head;
+    Player player;
+    EnemyPool enemies;
+    int flow_rows[2];  // Logical rows and words the last search touched, cleared before the next
+    int flow_words[2];
+    bool flow_stale;   // Player moved or the map changed since flow was built
+    int boss_count;
+    int world_offset;    // World row at the bottom of the map; logical row y is world row world_offset + height - 1 - y
+    int furthest_offset; // Largest world_offset reached; rows above that have never been on the map
+    Rng map_origin;      // Map stream before the run's first row, for generating any row again
+    ChunkStore *history;
+    int move_count;
+    long turn_count;
+    long death_turn;
+    const char *death_cause;
+    bool hit_by_boss; // Who hit the player last this turn, for death_cause once the turn is over
+    GameRandom rng;
+    Balance balance;
+    bool headless; // No drawing and no pauses from inside the simulation
+    bool realtime; // Keys only move the player; enemies move on 't' ticks from the scheduler
+    Rng ahead_rng[ROWS_AHEAD]; // Map stream state before each of grid.rows_ahead (what a save stores)
+    int ahead_next;
+    int ahead_count;
+} Game;
+
+// Outcome counts and histograms gathered by one simulator worker
+typedef struct
+{
+    unsigned long long games;
+    unsigned long long turns;
+    unsigned long long deaths_by_enemy;
+    unsigned long long deaths_by_boss;
+    unsigned long long survived; // Reached the turn cap
+    unsigned long long distance_sum;
+    unsigned long long level_sum;
+    int max_distance;
+    unsigned long long distance_counts[SIM_DISTANCE_BUCKETS];
+    unsigned long long level_counts[SIM_MAX_LEVEL + 1];
+} SimStats;
+
+// One simulator thread: plays games first_game, first_game + stride, ... below game_count
+typedef struct
+{
+    long first_game;
+    long stride;
+    long game_count;
+    long max_turns;
+    uint64_t base_seed;
+    SimStats stats;
+} SimWorker;
+
+// Replay file: header, a keyframe of the starting state, then one byte per turn with a
+// keyframe after every keyframe_interval turns. Keyframes use the save format.
+typedef struct
+{
+    char magic[4]; // "RBRP"
+    uint32_t version;
+    uint32_t keyframe_interval;
+} ReplayHeader;
+
+// Replay being written for the current run (file == NULL when not recording)
+typedef struct
+{
+    FILE *file;
+    long keyframe_interval;
+    long keyframes;
+} ReplayRecorder;
+
+typedef struct
+{
+    const char *path;
+    double rate;    // Turns per second when rendering, 0 = full speed without rendering
+    long seek_turn; // Start playback at this turn
+} ReplayConfig;
+
+// Fixed-timestep schedule of --realtime mode
+typedef struct
+{
+    double tick_length;  // Seconds per world tick
+    double frame_length; // Seconds per drawn frame
+    double next_tick;    // When the next tick and frame are due (now_seconds() time)
+    double next_frame;
+} TickClock;
+
+// Durations in TIMING_BUCKET_SECONDS buckets; longer than the range lands in the last one
+typedef struct
+{
+    unsigned long long count;
+    double total;
+    double max;
+    unsigned int buckets[TIMING_BUCKETS];
+} TimingHistogram;
+
+typedef struct
+{
+    TimingHistogram tick;             // Time to run one world tick
+    TimingHistogram frame;            // Time to draw one frame
+    TimingHistogram lateness;         // How long after its scheduled time each tick ran (jitter)
+    unsigned long long slow_frames;   // Loop passes whose keys, ticks and drawing overran a frame
+    unsigned long long dropped_ticks; // Ticks skipped after a stall instead of run in a burst
+} RealtimeStats;
+
+// Phases of a turn timed by --profile
+typedef enum
+{
+    PHASE_MOVEMENT,   // handle_movement()
+    PHASE_ENEMIES,    // move_enemies()
+    PHASE_COLLISIONS, // check_collisions()
+    PHASE_SPAWN,      // spawn_enemies()
+    PHASE_SHIFT,      // shift_world_down() and shift_world_up()
+    PHASE_DRAW,       // draw_game()
+    PHASE_FILE_IO,    // Saves, loads, autosave hand-offs, replay recording, history chunks, leaderboard
+    PHASE_COUNT
+} ProfilePhase;
+
+// Log-linear nanosecond histogram: exact below 2^PROFILE_SUB_BITS, then 2^PROFILE_SUB_BITS
+// buckets per power of two, so the range is unlimited and the relative error stays the same
+typedef struct
+{
+    unsigned long long count;
+    uint64_t total;
+    uint64_t max;
+    unsigned long long buckets[PROFILE_BUCKETS];
+} LatencyHistogram;
+
+// A phase in progress; time spent in phases started inside it is not counted as its own
+typedef struct
+{
+    double start;
+    double nested;
+} ProfileFrame;
+
+// Background leaderboard compaction: folds a retired journal into a new snapshot
+typedef struct
+{
+    bool running;     // A thread was started and not joined yet
+    atomic_bool done; // Set by the thread as it finishes, so the next compaction can join it
+    char snapshot_path[256];
+    char journal_path[256];
+#ifdef _WIN32
+    HANDLE thread;
+#else
+    pthread_t thread;
+#endif
+} LeaderboardCompaction;
+
 // Leaderboard entry structure
 typedef struct
 {
@@ -69,1276 +530,6458 @@ typedef struct
     int distance;
 } LeaderboardEntry;
 
-// Game data structure for saving/loading
+// Rank treap node for the entry with the same index
 typedef struct
 {
-    Player player;
-    Enemy enemies[MAX_ENEMIES];
-    int enemy_count;
-    char game_map[MAP_HEIGHT][MAP_WIDTH];
-    int world_offset;
-    int move_count;
-} GameData;
+    int left, right; // -1 = none
+    int size;        // Entries in this subtree, for rank lookups
+    uint32_t priority;
+} LeaderboardNode;
+
+// Leaderboard store: every player's best run. Entries never move once added; by_name hashes
+// names to entry indices and a treap over the same indices keeps them in rank order.
+typedef struct
+{
+    LeaderboardEntry *entries;
+    LeaderboardNode *nodes;
+    int count;
+    int capacity;
+    int root;
+    int *by_name;      // Open addressing table of entry indices, -1 = empty
+    int name_capacity; // Power of two, at least twice count
+    Rng priorities;
+} Leaderboard;
+
+// Background autosave: the game thread encodes a snapshot into pending and the writer thread
+// swaps it with writing and puts it on disk, so the game never waits for the file system
+typedef struct
+{
+    bool running;
+    bool stop;
+    bool pending_ready; // pending holds a snapshot the writer has not taken yet
+    bool busy;          // The writer is putting writing on disk
+    bool last_ok;
+    ByteWriter pending;
+    ByteWriter writing;
+    long last_turn;     // Turn and time of the last snapshot handed over
+    double last_time;
+    unsigned long long requested;
+    unsigned long long written;
+    unsigned long long coalesced; // Snapshots replaced before the writer got to them
+    unsigned long long failed;
+    double stall_total; // Seconds the game thread spent handing snapshots over
+    double stall_max;
+    double write_total; // Seconds the writer spent per file
+    double write_max;
+#ifdef _WIN32
+    CRITICAL_SECTION lock;
+    CONDITION_VARIABLE work;
+    CONDITION_VARIABLE idle;
+    HANDLE thread;
+#else
+    pthread_mutex_t lock;
+    pthread_cond_t work;
+    pthread_cond_t idle;
+    pthread_t thread;
+#endif
+} Autosaver;
+
+// State of one benchmark case; a kernel does one operation per call
+typedef struct
+{
+    Game *game;
+    Game *copy;         // Decode target of the save kernels
+    Leaderboard board;
+    ByteWriter payload; // Reused save encoding buffer
+    long step;          // Operations done so far
+} BenchContext;
+
+typedef struct
+{
+    const char *name;
+    void (*run)(BenchContext *context);
+} BenchKernel;
+
+// Nanoseconds per operation over BENCH_BATCHES batches
+typedef struct
+{
+    const char *kernel;
+    long long iterations;
+    double median;
+    double fastest;
+} BenchResult;
+
+// One connected spectator; bytes its socket would not take yet wait in backlog
+typedef struct
+{
+    int fd;
+    ByteWriter backlog;
+    size_t sent;          // Bytes at the front of backlog already sent
+    bool needs_full;      // Gets a full frame next instead of diffs (new, or dropped behind)
+    bool watching_output; // Registered for EPOLLOUT
+} SpectatorClient;
+
+// Spectator server: the game thread diffs each drawn frame against shown into diff, and the
+// broadcaster thread sends that one buffer to every client from its epoll loop
+typedef struct
+{
+    bool running;
+    bool stop;
+    bool tcp;
+    int listen_fd;
+    int epoll_fd;
+    int wake_fd;         // eventfd the game thread signals after publishing a frame
+    char unix_path[108]; // Removed on shutdown
+    ScreenCell shown[MAX_SCREEN_HEIGHT][MAX_SCREEN_WIDTH]; // Latest published frame
+    int width, height;
+    bool has_frame;
+    bool resync;          // The screen changed size: every client needs a full frame
+    ByteWriter diff;      // Cell changes published since the broadcaster last took them
+    ByteWriter broadcast; // Broadcaster side: the diffs being sent
+    ByteWriter full;      // Broadcaster side: a full frame for new or caught up clients
+    SpectatorClient clients[SPECTATOR_MAX_CLIENTS];
+    int client_count;
+#ifdef __linux__
+    pthread_mutex_t lock;
+    pthread_t thread;
+#endif
+} SpectatorServer;
+
+// Where a frame encoder left the cursor and color, so it only emits changes
+typedef struct
+{
+    int x, y;
+    int color;
+} SpectatorCursor;
 
 // Global variables
-char game_map[MAP_HEIGHT][MAP_WIDTH];
-Player player;
-Enemy enemies[MAX_ENEMIES];
-int enemy_count = 0;
-LeaderboardEntry leaderboard[MAX_LEADERBOARD];
-int leaderboard_size = 0;
-int world_offset = 0;
-int move_count = 0;
-int initial_rows = MAP_HEIGHT / 2;
+Leaderboard leaderboard = {.root = -1};
+Autosaver autosaver;
+SpectatorServer spectators;
+long autosave_turns = AUTOSAVE_TURNS; // --autosave N, 0 = off
+double autosave_seconds = 0;          // --autosave-seconds S, 0 = turns only
+bool autosave_option_set = false;     // Games autosave only when asked to
+bool report_autosave_stats = false;   // Print autosave statistics on exit
+int leaderboard_journal_records = 0; // Records in the live journal since it was last retired
+LeaderboardCompaction leaderboard_compaction;
+bool seed_option_set = false; // --seed given: every new run uses seed_option
+uint64_t seed_option = 0;
+Balance balance_option; // Balance every new game starts with (defaults plus --balance overrides)
+WorldSize world_option = {DEFAULT_MAP_WIDTH, DEFAULT_MAP_HEIGHT, DEFAULT_MAX_ENEMIES}; // --map-width, --map-height, --max-enemies
+const char *record_path = NULL; // --record PATH, otherwise interactive runs record to get_replay_path()
+bool record_enabled = true;     // --no-record turns recording off
+long keyframe_interval_option = REPLAY_KEYFRAME_INTERVAL;
+long chunk_budget_kb = DEFAULT_CHUNK_BUDGET_KB; // --chunk-budget KB of resident history per game
+bool report_chunk_stats = false;                // --chunk-stats: print history store statistics after headless runs
+double realtime_tick_rate = 0;                  // --realtime HZ: world ticks per second, 0 = turn based
+double realtime_frame_rate = DEFAULT_FRAME_RATE; // --fps N
+bool report_tick_stats = false;                 // --tick-stats: print real-time loop timings on exit
+RealtimeStats realtime_stats;
+bool profiling = false; // --profile or ROGUEBYTE_PROFILE: time each phase and report on exit
+LatencyHistogram profile_phases[PHASE_COUNT];
+ProfileFrame profile_stack[PROFILE_MAX_DEPTH];
+int profile_depth = 0; // Phases in progress, including any past PROFILE_MAX_DEPTH
+
+// Renderer state: back buffer is composed each frame, front buffer mirrors the terminal
+ScreenCell back_buffer[MAX_SCREEN_HEIGHT][MAX_SCREEN_WIDTH];
+ScreenCell front_buffer[MAX_SCREEN_HEIGHT][MAX_SCREEN_WIDTH];
+int screen_width = MIN_SCREEN_WIDTH;                  // Cells of the buffers in use: the viewport plus the HUD
+int screen_height = DEFAULT_MAP_HEIGHT + HUD_LINES;
+int terminal_width = DEFAULT_TERMINAL_WIDTH;          // Read once at startup by query_terminal_size()
+int terminal_height = DEFAULT_TERMINAL_HEIGHT;
+Viewport view = {0, 0, DEFAULT_MAP_WIDTH, DEFAULT_MAP_HEIGHT};
+bool front_buffer_valid = false;
+TimedMessage messages[MESSAGE_LINES]; // MSG_LINE_1 .. MSG_LINE_3
+char output_buffer[OUTPUT_BUFFER_SIZE];
+size_t output_length = 0;
+RenderSink render_sink;          // Backend selected at startup (stdout by default)
+bool report_sink_stats = false;  // Print sink statistics on exit
+
+// Input state: raw mode is entered once, keys are decoded into a ring queue
+int input_queue[INPUT_QUEUE_SIZE];
+int input_head = 0;
+int input_tail = 0;
+unsigned char input_bytes[64]; // Bytes read but not yet decoded (split escape sequences)
+int input_byte_count = 0;
+#ifndef _WIN32
+struct termios original_termios;
+bool raw_mode_enabled = false;
+#endif
 
 // Function prototypes
 
 // Terminal control functions
-void clear_screen();            // Function definition
-void move_cursor(int x, int y); // Function definition
-char getch();                   // Function definition
-void enable_ansi();             // Function definition
-void msleep(int milliseconds);  // Function definition
+void clear_screen();                // Function definition
+void move_cursor(int x, int y);     // Function definition
+void enable_ansi();                 // Function definition
+void sleep_seconds(double seconds); // Function definition
+
+// Render sink functions
+bool open_render_sink(const char *spec);     // Function definition
+void close_render_sink();                    // Function definition
+void end_frame();                            // Function definition
+void report_render_sink(FILE *stream);       // Function definition
+void shutdown_render_sink();                 // Function definition
+
+// Frame renderer functions
+void output_append(const char *data, size_t length);                  // Function definition
+void output_printf(const char *format, ...);                          // Function definition
+void output_flush();                                                  // Function definition
+void clear_back_buffer();                                             // Function definition
+void put_cell(int x, int y, char glyph, CellColor color);             // Function definition
+int put_text(int x, int y, CellColor color, const char *format, ...); // Function definition
+void invalidate_front_buffer();                                       // Function definition
+void present_frame();                                                 // Function definition
+void query_terminal_size();                                           // Function definition
+void update_viewport(Game *game);                                     // Function definition
+
+// Input functions
+void enable_raw_mode();                      // Function definition
+void restore_terminal();                     // Function definition
+void push_key(int key);                      // Function definition
+void decode_input_bytes(bool flush_partial); // Function definition
+bool pump_input(int timeout_ms);             // Function definition
+bool poll_key(int *key);                     // Function definition
+int wait_key();                              // Function definition
+char key_to_char(int key);                   // Function definition
+char get_key();                              // Function definition
 
 // Message system functions
-void clear_messages();                                           // Function definition
-void display_message(const char *msg, int line, bool important); // Function definition
+void clear_messages();                                                                                // Function definition
+void display_message(const char *msg, int line, bool important);                                      // Function definition
+void post_message(Game *game, int line, CellColor color, const char *msg, double seconds, int turns); // Function definition
+void draw_messages(Game *game);                                                                       // Function definition
+int message_wait_ms();                                                                                // Function definition
+bool wait_for_key(int timeout_ms);                                                                    // Function definition
 
 // File path functions
 char *get_leaderboard_path();
+char *get_legacy_leaderboard_path();
+char *get_leaderboard_journal_path();
+char *get_retired_journal_path();
 char *get_save_file_path();
+char *get_replay_path();
 void ensure_directory_exists(const char *path);             // Function definition
 bool safe_rename(const char *oldpath, const char *newpath); // Function definition
+bool sync_file(FILE *file);                                 // Function definition
+
+// Game instance functions
+Game *create_game(bool headless);                                            // Function definition
+void destroy_game(Game *game);                                               // Function definition
+bool arena_init(Arena *arena, size_t capacity);                              // Function definition
+void *arena_alloc(Arena *arena, size_t size);                                // Function definition
+void arena_free(Arena *arena);                                               // Function definition
+bool allocate_grid(Game *game, int width, int height);                       // Function definition
+bool set_world_option(WorldSize *size, const char *name, const char *value); // Function definition
+
+// Random generator functions
+void rng_seed(Rng *rng, uint64_t seed, uint64_t stream); // Function definition
+uint32_t rng_next(Rng *rng);                             // Function definition
+uint32_t rng_range(Rng *rng, uint32_t bound);            // Function definition
+void rng_advance(Rng *rng, uint64_t steps);              // Function definition
+void seed_game_random(Game *game, uint64_t seed);        // Function definition
+uint64_t pick_run_seed();                                // Function definition
 
 // Game initialization functions
-void init_player();           // Function definition
-void generate_new_row(int y); // Function definition
-void init_map();              // Function definition
+void init_player(Game *game);                                                            // Function definition
+void generate_row_tiles(char *row, int width, Rng *rng, bool boss_room, bool boss_line); // Function definition
+void generate_new_row(Game *game, int y);                                                // Function definition
+void fill_rows_ahead(Game *game);                                                        // Function definition
+void scroll_in_row(Game *game);                                                          // Function definition
+void init_map(Game *game);                                                               // Function definition
+
+// Map access functions
+int map_row_index(Game *game, int y);                // Function definition
+char *map_row(Game *game, int y);                    // Function definition
+char tile_at(Game *game, int x, int y);              // Function definition
+void export_map(Game *game, char *dst);              // Function definition
+void import_map(Game *game, const char *src);        // Function definition
+void update_walkable_row(Game *game, int y);         // Function definition
+bool is_walkable(Game *game, int x, int y);          // Function definition
+uint64_t column_span(int first, int last, int word); // Function definition
+
+// World history functions
+ChunkStore *open_chunk_store(int width);                                        // Function definition
+void close_chunk_store(ChunkStore *store);                                      // Function definition
+bool reset_chunk_store(ChunkStore *store, int width, const Rng *origin);        // Function definition
+ChunkStore *run_history(Game *game);                                            // Function definition
+ChunkSlot *chunk_slot(ChunkStore *store, long id, bool create);                 // Function definition
+bool read_chunk_record(ChunkStore *store, long id, ChunkRecord *record);        // Function definition
+bool write_chunk(ChunkStore *store, ChunkSlot *slot);                           // Function definition
+bool load_chunk(ChunkStore *store, ChunkSlot *slot, const ChunkRecord *record); // Function definition
+uint64_t row_stream_draws(Game *game, long world_row);                          // Function definition
+void rebuild_world_row(Game *game, long world_row, char *row);                  // Function definition
+void store_history_row(Game *game, long world_row, const char *row);            // Function definition
+void fetch_history_row(Game *game, long world_row, char *row);                  // Function definition
+void prefetch_history(Game *game, long world_row);                              // Function definition
+void report_chunk_store(FILE *stream, const ChunkStore *store);                 // Function definition
+
+// Enemy pool functions
+bool reserve_enemies(EnemyPool *pool, int capacity);       // Function definition
+EnemyHandle add_enemy(EnemyPool *pool, Enemy enemy);       // Function definition
+void remove_enemy(EnemyPool *pool, int index);             // Function definition
+EnemyHandle enemy_handle(const EnemyPool *pool, int index); // Function definition
+Enemy *get_enemy(EnemyPool *pool, EnemyHandle handle);     // Function definition
+void clear_enemies(EnemyPool *pool);                       // Function definition
+void free_enemy_pool(EnemyPool *pool);                     // Function definition
+
+// Occupancy grid functions
+void link_enemy(Game *game, int slot, int x, int y);                              // Function definition
+void unlink_enemy(Game *game, int slot, int x, int y);                            // Function definition
+void reset_enemies(Game *game);                                                   // Function definition
+EnemyHandle place_enemy(Game *game, Enemy enemy);                                 // Function definition
+void despawn_enemy(Game *game, int index);                                        // Function definition
+void move_enemy(Game *game, int index, int x, int y);                             // Function definition
+int enemy_at(Game *game, int x, int y);                                           // Function definition
+int find_enemies_near(Game *game, int x, int y, int radius, int *found, int max); // Function definition
 
 // Game logic functions
-void update_score();     // Function definition
-void shift_world_down(); // Function definition
-void spawn_enemies();    // Function definition
-void move_enemies();     // Function definition
-void check_collisions(); // Function definition
+void update_score(Game *game);                              // Function definition
+void shift_world_down(Game *game);                          // Function definition
+void shift_world_up(Game *game);                            // Function definition
+int count_spawn_cells(Game *game);                          // Function definition
+uint64_t spawn_cell_bits(Game *game, int y, int word);      // Function definition
+bool take_spawn_cell(Game *game, int pick, int *x, int *y); // Function definition
+int spawn_enemies(Game *game);                              // Function definition
+void move_enemies(Game *game);                              // Function definition
+void check_collisions(Game *game);                          // Function definition
+
+// Pathfinding functions
+void update_flow_field(Game *game);                                                      // Function definition
+bool flow_step(Game *game, const Enemy *enemy, bool prefer_x, int *step_x, int *step_y); // Function definition
 
 // Display functions
-void draw_game();                  // Function definition
+void draw_game(Game *game);        // Function definition
 void show_welcome_screen();        // Function definition
 int show_main_menu(bool has_save); // Function definition
 void show_leaderboard();           // Function definition
 
+// Leaderboard store functions
+uint32_t hash_name(const char *name);                                                   // Function definition
+bool ranks_before(const LeaderboardEntry *a, const LeaderboardEntry *b);                // Function definition
+bool reserve_leaderboard(Leaderboard *board, int capacity);                             // Function definition
+int find_leaderboard_entry(const Leaderboard *board, const char *name);                 // Function definition
+int append_leaderboard_entry(Leaderboard *board, const LeaderboardEntry *entry);        // Function definition
+void update_rank_size(Leaderboard *board, int node);                                    // Function definition
+int insert_rank(Leaderboard *board, int root, int index);                               // Function definition
+int merge_ranks(Leaderboard *board, int a, int b);                                      // Function definition
+int remove_rank(Leaderboard *board, int root, int index);                               // Function definition
+int compute_rank_sizes(Leaderboard *board, int node);                                   // Function definition
+int build_ranks(Leaderboard *board);                                                    // Function definition
+int leaderboard_rank(const Leaderboard *board, int index);                              // Function definition
+int leaderboard_at(const Leaderboard *board, int rank);                                 // Function definition
+bool upsert_leaderboard(Leaderboard *board, const char *name, int level, int distance); // Function definition
+void clear_leaderboard(Leaderboard *board);                                             // Function definition
+void free_leaderboard(Leaderboard *board);                                              // Function definition
+
 // Leaderboard functions
-void load_leaderboard();           // Function definition
-bool update_leaderboard_entries(); // Function definition
-void add_to_leaderboard();         // Function definition
-void show_leaderboard();           // Function definition
+int encode_leaderboard_record(const LeaderboardEntry *entry, unsigned char *out);                // Function definition
+long decode_leaderboard_record(const unsigned char *data, long length, LeaderboardEntry *entry); // Function definition
+bool read_leaderboard_file(Leaderboard *board, const char *path);                                // Function definition
+bool write_leaderboard_file(const Leaderboard *board, const char *path);                         // Function definition
+bool import_legacy_leaderboard(Leaderboard *board, const char *path);                            // Function definition
+bool append_leaderboard_journal(const char *path, const LeaderboardEntry *entry);                // Function definition
+int replay_leaderboard_journal(Leaderboard *board, const char *path, bool *torn);                // Function definition
+bool compact_leaderboard(const char *snapshot_path, const char *journal_path);                   // Function definition
+void start_leaderboard_compaction();                                                             // Function definition
+void finish_leaderboard_compaction();                                                            // Function definition
+void load_leaderboard();                                                                         // Function definition
+int add_to_leaderboard(Game *game);                                                              // Function definition
+void show_leaderboard();                                                                         // Function definition
 
 // Save/load functions
-bool save_game(const GameData *data); // Function definition
-bool load_game(GameData *data);       // Function definition
-bool save_file_exists();              // Function definition
+uint32_t checksum_bytes(const void *data, size_t length);                              // Function definition
+void write_bytes(ByteWriter *writer, const void *data, size_t length);                 // Function definition
+void write_u8(ByteWriter *writer, uint8_t value);                                      // Function definition
+void write_u16(ByteWriter *writer, uint16_t value);                                    // Function definition
+void write_u32(ByteWriter *writer, uint32_t value);                                    // Function definition
+void write_u64(ByteWriter *writer, uint64_t value);                                    // Function definition
+bool read_bytes(ByteReader *reader, void *out, size_t length);                         // Function definition
+uint8_t read_u8(ByteReader *reader);                                                   // Function definition
+uint16_t read_u16(ByteReader *reader);                                                 // Function definition
+uint32_t read_u32(ByteReader *reader);                                                 // Function definition
+uint64_t read_u64(ByteReader *reader);                                                 // Function definition
+const unsigned char *map_file(const char *path, size_t *length);                       // Function definition
+void unmap_file(const unsigned char *data, size_t length);                             // Function definition
+const Rng *map_stream_front(const Game *game);                                         // Function definition
+void encode_save(ByteWriter *writer, Game *game);                                      // Function definition
+bool decode_save(ByteReader *reader, Game *game);                                      // Function definition
+bool check_save_header(const unsigned char *data, size_t length, ByteReader *payload); // Function definition
+void encode_save_header(unsigned char *header, const ByteWriter *payload);             // Function definition
+bool write_save_file(const char *path, const ByteWriter *payload);                     // Function definition
+bool save_game(Game *game);                                                            // Function definition
+bool load_game(Game *game);                                                            // Function definition
+bool save_file_exists();                                                               // Function definition
+
+// Autosave functions
+void lock_autosave();               // Function definition
+void unlock_autosave();             // Function definition
+void start_autosave();              // Function definition
+bool request_autosave(Game *game);  // Function definition
+bool wait_autosave();               // Function definition
+void cancel_autosave();             // Function definition
+void maybe_autosave(Game *game);    // Function definition
+void stop_autosave();               // Function definition
+void report_autosave(FILE *stream); // Function definition
+
+// Spectator functions
+bool start_spectator_server(const char *spec);                                                       // Function definition
+void stop_spectator_server();                                                                        // Function definition
+void publish_spectator_frame();                                                                      // Function definition
+void encode_spectator_cell(ByteWriter *out, SpectatorCursor *cursor, int x, int y, ScreenCell cell); // Function definition
+void finish_spectator_frame(ByteWriter *out, SpectatorCursor *cursor, int height);                   // Function definition
+void encode_spectator_full(ByteWriter *out);                                                         // Function definition
+void accept_spectators();                                                                            // Function definition
+int find_spectator(int fd);                                                                          // Function definition
+bool watch_spectator(SpectatorClient *client);                                                       // Function definition
+bool send_to_spectator(SpectatorClient *client, const unsigned char *data, size_t length);           // Function definition
+bool flush_spectator(SpectatorClient *client);                                                       // Function definition
+bool serve_spectator(SpectatorClient *client, uint32_t events);                                      // Function definition
+void drop_spectator(int index);                                                                      // Function definition
+void broadcast_spectator_frame();                                                                    // Function definition
+void *spectator_thread_main(void *arg);                                                              // Function definition
+int run_spectator_check();                                                                           // Function definition
 
 // Game flow functions
-void game_over();                     // Function definition
-void get_player_name();               // Function definition
-void handle_movement(int dx, int dy); // Function definition
-void game_loop();                     // Function definition
+void game_over(Game *game);                       // Function definition
+void get_player_name(Game *game);                 // Function definition
+void handle_movement(Game *game, int dx, int dy); // Function definition
+void play_turn(Game *game, char ch);              // Function definition
+GameState apply_game_key(Game *game, ReplayRecorder *recorder, int key); // Function definition
+void game_loop();                                 // Function definition
+void print_usage(const char *program);            // Function definition
+
+// Headless functions
+double now_seconds();                                                                  // Function definition
+void start_new_run(Game *game, uint64_t seed);                                         // Function definition
+char random_policy_key(Game *game);                                                    // Function definition
+int read_script_key(FILE *input);                                                      // Function definition
+int run_headless(const HeadlessConfig *config);                                        // Function definition
+void report_run(const Game *game, const char *end_reason, long turns, double elapsed); // Function definition
+
+// Real-time functions
+void start_tick_clock(TickClock *clock, double now);                                   // Function definition
+bool tick_due(TickClock *clock, double now);                                           // Function definition
+bool frame_due(TickClock *clock, double now);                                          // Function definition
+double clock_wait(const TickClock *clock, double now);                                 // Function definition
+void run_world_tick(Game *game, ReplayRecorder *recorder);                             // Function definition
+void draw_realtime_frame(Game *game, const TickClock *clock, double pass_start);       // Function definition
+GameState play_realtime_frame(Game *game, ReplayRecorder *recorder, TickClock *clock); // Function definition
+void record_timing(TimingHistogram *histogram, double seconds);                        // Function definition
+double timing_percentile(const TimingHistogram *histogram, double fraction);           // Function definition
+void report_realtime(FILE *stream);                                                    // Function definition
+
+// Profiler functions
+void profile_begin();                                                            // Function definition
+void profile_end(ProfilePhase phase);                                            // Function definition
+int latency_bucket(uint64_t nanoseconds);                                        // Function definition
+uint64_t latency_bucket_limit(int bucket);                                       // Function definition
+void record_latency(LatencyHistogram *histogram, uint64_t nanoseconds);          // Function definition
+uint64_t latency_percentile(const LatencyHistogram *histogram, double fraction); // Function definition
+void report_profile();                                                           // Function definition
+
+// Simulator functions
+uint64_t mix_seed(uint64_t value);                               // Function definition
+bool set_balance_option(Balance *balance, const char *spec);     // Function definition
+void run_sim_games(SimWorker *worker);                           // Function definition
+int default_thread_count();                                      // Function definition
+int distance_percentile(const SimStats *stats, double fraction); // Function definition
+int run_simulation(long games, int threads, long max_turns);     // Function definition
+
+// Benchmark functions
+Game *create_bench_game(int width, int height, int enemies);                                     // Function definition
+void fill_bench_leaderboard(Leaderboard *board, int entries);                                    // Function definition
+void bench_generate_new_row(BenchContext *context);                                              // Function definition
+void bench_shift_world_down(BenchContext *context);                                              // Function definition
+void bench_move_enemies(BenchContext *context);                                                  // Function definition
+void bench_check_collisions(BenchContext *context);                                              // Function definition
+void bench_spawn_enemies(BenchContext *context);                                                 // Function definition
+void bench_draw_game(BenchContext *context);                                                     // Function definition
+void bench_save_memory(BenchContext *context);                                                   // Function definition
+void bench_save_file(BenchContext *context);                                                     // Function definition
+void bench_leaderboard_load(BenchContext *context);                                              // Function definition
+void bench_leaderboard_update(BenchContext *context);                                            // Function definition
+void bench_leaderboard_sort(BenchContext *context);                                              // Function definition
+BenchResult time_bench_kernel(const BenchKernel *kernel, BenchContext *context);                 // Function definition
+void report_bench_result(FILE *out, bool *first, const BenchResult *result, const char *params); // Function definition
+int run_benchmarks(const char *path);                                                            // Function definition
+
+// Replay functions
+char replay_key(char ch);                                                       // Function definition
+bool write_snapshot(FILE *file, Game *game);                                    // Function definition
+long read_snapshot_header(FILE *file, long file_length, unsigned char *header); // Function definition
+bool read_snapshot(FILE *file, long file_length, Game *game);                   // Function definition
+bool skip_snapshot(FILE *file, long file_length);                               // Function definition
+bool snapshots_match(Game *a, Game *b);                                         // Function definition
+bool start_recording(ReplayRecorder *recorder, const char *path, Game *game);   // Function definition
+void record_turn(ReplayRecorder *recorder, Game *game, char ch);                // Function definition
+void stop_recording(ReplayRecorder *recorder);                                  // Function definition
+int run_replay(const ReplayConfig *config);                                     // Function definition
 // debugging
 //void debug_game_state(); // Function definition
 
 // Terminal control implementations
+// Both go through the render sink as ANSI sequences (enable_ansi() turns them on for Windows consoles)
 void clear_screen() // Function definition
 {
-#ifdef _WIN32
-    system("cls");
-#else
-    printf("\033[2J\033[H");
-#endif
+    invalidate_front_buffer(); // Whatever was on screen is gone, next frame repaints fully
+    output_printf("\033[2J\033[H");
 }
 
 void move_cursor(int x, int y) // Function definition
 {
-#ifdef _WIN32
-    HANDLE hConsole = GetStdHandle(STD_OUTPUT_HANDLE);
-    COORD pos = {x, y};
-    SetConsoleCursorPosition(hConsole, pos);
-#else
-    printf("\033[%d;%dH", y + 1, x + 1);
-#endif
+    output_printf("\033[%d;%dH", y + 1, x + 1);
 }
 
+// Input implementations
 #ifndef _WIN32
-char getch() // Function definition
-{
-    struct termios oldt, newt;
-    char ch;
-    tcgetattr(STDIN_FILENO, &oldt);
-    newt = oldt;
-    newt.c_lflag &= ~(ICANON | ECHO);
-    tcsetattr(STDIN_FILENO, TCSANOW, &newt);
-    ch = getchar();
-    tcsetattr(STDIN_FILENO, TCSANOW, &oldt);
-    return ch;
-}
-#endif
-
-
-#ifdef _WIN32
-void enable_ansi() // Function definition
+void restore_terminal() // Function definition
 {
-    HANDLE hOut = GetStdHandle(STD_OUTPUT_HANDLE);
-    if (hOut == INVALID_HANDLE_VALUE)
-        return;
-
-    DWORD dwMode = 0;
-    if (!GetConsoleMode(hOut, &dwMode))
-        return;
-
-#ifndef ENABLE_VIRTUAL_TERMINAL_PROCESSING
-#define ENABLE_VIRTUAL_TERMINAL_PROCESSING 0x0004 // Game constant definition
-#endif
-
-    dwMode |= ENABLE_VIRTUAL_TERMINAL_PROCESSING;
-    SetConsoleMode(hOut, dwMode);
+    if (raw_mode_enabled)
+    {
+        tcsetattr(STDIN_FILENO, TCSANOW, &original_termios);
+        raw_mode_enabled = false;
+    }
 }
-#endif
 
-void msleep(int milliseconds) // Function definition
+void handle_fatal_signal(int sig) // Function definition
 {
-    #ifdef _WIN32
-        Sleep(milliseconds);
-    #else
-        usleep(milliseconds * 1000);
-    #endif
+    restore_terminal();
+    signal(sig, SIG_DFL);
+    raise(sig);
 }
 
-// Message system implementations
-void clear_messages() // Function definition
+void handle_stop_signal(int sig) // Function definition
 {
-    for (int i = MSG_LINE_1; i <= MSG_LINE_3; i++)
-    {
-        move_cursor(0, i);
-        printf("%-60s", "");
-    }
-    fflush(stdout);
+    (void)sig;
+    bool was_raw = raw_mode_enabled;
+    restore_terminal();
+    raw_mode_enabled = was_raw; // Remember to re-enter raw mode on SIGCONT
+    raise(SIGSTOP);
 }
 
-void display_message(const char *msg, int line, bool important) // Function definition
+void handle_continue_signal(int sig) // Function definition
 {
-    move_cursor(0, line);
-    if (important)
-    {
-#ifdef _WIN32
-        printf(">>> %-60s <<<", msg);
-#else
-        printf("\033[1;31m>>> %s <<<\033[0m", msg);
-#endif
-    }
-    else
+    (void)sig;
+    if (raw_mode_enabled)
     {
-        printf("%s", msg);
+        struct termios raw = original_termios;
+        raw.c_lflag &= ~(ICANON | ECHO);
+        raw.c_cc[VMIN] = 0;
+        raw.c_cc[VTIME] = 0;
+        tcsetattr(STDIN_FILENO, TCSANOW, &raw);
     }
-    fflush(stdout);
+    invalidate_front_buffer(); // The shell drew over us while stopped
 }
+#endif
 
-// File path implementations
-char *get_leaderboard_path()
+// Puts the terminal in non-canonical, no-echo mode once for the whole session
+void enable_raw_mode() // Function definition
 {
-    static char path[256];
-    snprintf(path, sizeof(path), "leaderboard.txt"); // Force current directory
-    // printf("DEBUG: Leaderboard path: %s\n", path);
-    return path;
-}
+#ifndef _WIN32
+    if (raw_mode_enabled || !isatty(STDIN_FILENO) || tcgetattr(STDIN_FILENO, &original_termios) != 0)
+        return;
 
-char *get_save_file_path()
-{
-    static char path[256];
-    snprintf(path, sizeof(path), "savegame.dat"); // Force current directory
-    // printf("DEBUG: Save file path: %s\n", path);
-    return path;
-}
+    struct termios raw = original_termios;
+    raw.c_lflag &= ~(ICANON | ECHO);
+    raw.c_cc[VMIN] = 0; // read() returns whatever is pending, poll() does the waiting
+    raw.c_cc[VTIME] = 0;
+    if (tcsetattr(STDIN_FILENO, TCSANOW, &raw) != 0)
+        return;
+    raw_mode_enabled = true;
+    atexit(restore_terminal);
 
-void ensure_directory_exists(const char *path)
-{ // Function definition
-#ifndef _WIN32
-    // For Unix: Check if directory exists
-    char *sep = strrchr(path, '/');
-    if (sep)
+    int fatal_signals[] = {SIGINT, SIGTERM, SIGHUP, SIGQUIT};
+    for (size_t i = 0; i < sizeof(fatal_signals) / sizeof(fatal_signals[0]); i++)
     {
-        char dirpath[256];
-        strncpy(dirpath, path, sep - path);
-        dirpath[sep - path] = '\0';
-        mkdir(dirpath, S_IRWXU); // Create if doesn't exist
+        signal(fatal_signals[i], handle_fatal_signal);
     }
+    signal(SIGTSTP, handle_stop_signal);
+    signal(SIGCONT, handle_continue_signal);
 #endif
 }
 
-bool safe_rename(const char *oldpath, const char *newpath)
-{ // Function definition
-#ifdef _WIN32
-    // Windows needs special handling
-    remove(newpath); // Delete destination if exists
-#endif
-    return rename(oldpath, newpath) == 0; // Function definition
-}
-
-// Game initialization implementations
-void init_player() // Function definition
+void push_key(int key) // Function definition
 {
-    player.x = MAP_WIDTH / 2;
-    player.y = initial_rows;
-    player.max_hp = 20;
-    player.hp = player.max_hp;
-    player.strength = 5;
-    player.level = 1;
-    player.xp = 0;
-    player.xp_to_level = 10;
-    player.score = 0;
+    int next = (input_tail + 1) % INPUT_QUEUE_SIZE;
+    if (next == input_head)
+        return; // Queue full, drop the key rather than block
+    input_queue[input_tail] = key;
+    input_tail = next;
 }
 
-void generate_new_row(int y) // Function definitionww
+// Turns buffered bytes into key events; incomplete escape sequences wait for more bytes
+void decode_input_bytes(bool flush_partial) // Function definition
 {
-    bool is_boss_room = (world_offset >= 200) && (world_offset % 200 == 0);
-
-    for (int x = 0; x < MAP_WIDTH; x++)
+    int i = 0;
+    while (i < input_byte_count)
     {
-        if (x == 0 || x == MAP_WIDTH - 1)
-        {
-            game_map[y][x] = '|'; // Walls
-        }
-        else
+        unsigned char c = input_bytes[i];
+        if (c == 27)
         {
-            if (is_boss_room && x >= MAP_WIDTH / 2 - 5 && x <= MAP_WIDTH / 2 + 5)
+            if (i + 1 >= input_byte_count || (input_bytes[i + 1] == '[' && i + 2 >= input_byte_count))
             {
-                game_map[y][x] = (y == MAP_HEIGHT / 2) ? 'B' : '_';
+                if (!flush_partial)
+                    break;
+                push_key(27); // Lone escape
+                i++;
+                continue;
             }
-            else
+            if (input_bytes[i + 1] == '[' || input_bytes[i + 1] == 'O')
             {
-                int r = rand() % 100;
-                if (r < 5)
-                {
-                    if (x < MAP_WIDTH - 2)
-                    {
-                        game_map[y][x] = '[';
-                        game_map[y][x + 1] = ']';
-                        x++;
-                    }
-                    else
-                    {
-                        game_map[y][x] = '_';
-                    }
-                }
-                else if (r < 10) // Function definition
-                {
-                    game_map[y][x] = '~';
-                }
-                else
+                switch (input_bytes[i + 2])
                 {
-                    game_map[y][x] = '_';
+                case 'A':
+                    push_key(KEY_UP);
+                    break;
+                case 'B':
+                    push_key(KEY_DOWN);
+                    break;
+                case 'C':
+                    push_key(KEY_RIGHT);
+                    break;
+                case 'D':
+                    push_key(KEY_LEFT);
+                    break;
                 }
+                i += 3;
+                continue;
             }
         }
+        push_key(c);
+        i++;
     }
-}
-
-void init_map() // Function definition
-{
-    for (int y = 0; y < MAP_HEIGHT; y++)
-    {
-        generate_new_row(y);
-    }
-}
 
-// Game logic implementations
-void update_score() // Function definition
-{
-    player.score = world_offset;
+    memmove(input_bytes, input_bytes + i, input_byte_count - i);
+    input_byte_count -= i;
 }
 
-void shift_world_down() // Function definition
+// Waits up to timeout_ms (-1 = forever) for input and decodes everything pending
+bool pump_input(int timeout_ms) // Function definition
 {
-    bool is_boss_room = (world_offset >= 200) && (world_offset % 200 == 0);
-
-    if (is_boss_room)
-    {
-        int boss_x = MAP_WIDTH / 2;
-        int boss_y = MAP_HEIGHT / 2;
-
-        enemies[enemy_count] = (Enemy){
-            boss_x, boss_y,
-            40 + (world_offset / 30),
-            8 + (world_offset / 60),
-            80 + (world_offset / 25),
-            true};
-        enemy_count++;
-
-        move_cursor(0, MSG_LINE_1);
-        printf("\033[1;31m!!! BOSS AHEAD !!!\033[0m");
-        move_cursor(0, MSG_LINE_2);
-        printf("\033[1;31mDefeat it to progress!\033[0m");
-
-        // Ensure messages stay visible for at least 2 moves
-        draw_game();
-        msleep(1000); // Brief pause but not blocking
-    }
-
-    for (int y = MAP_HEIGHT - 1; y > 0; y--)
+#ifdef _WIN32
+    if (timeout_ms != 0 && !_kbhit())
     {
-        memcpy(game_map[y], game_map[y - 1], MAP_WIDTH);
+        DWORD start = GetTickCount();
+        while (!_kbhit() && (timeout_ms < 0 || (int)(GetTickCount() - start) < timeout_ms))
+        {
+            Sleep(1);
+        }
     }
-    generate_new_row(0);
-    world_offset++;
-    update_score();
-
-    player.y++;
-    for (int i = 0; i < enemy_count; i++)
+    while (_kbhit())
     {
-        enemies[i].y++;
-        if (enemies[i].y >= MAP_HEIGHT)
+        int c = _getch();
+        if (c == 0 || c == 224) // Extended key, the scan code follows
         {
-            for (int j = i; j < enemy_count - 1; j++)
-            {
-                enemies[j] = enemies[j + 1];
-            }
-            enemy_count--;
-            i--;
+            int code = _getch();
+            if (code == 72)
+                push_key(KEY_UP);
+            else if (code == 80)
+                push_key(KEY_DOWN);
+            else if (code == 77)
+                push_key(KEY_RIGHT);
+            else if (code == 75)
+                push_key(KEY_LEFT);
+        }
+        else
+        {
+            push_key(c);
         }
     }
-}
+    return input_head != input_tail;
+#else
+    struct pollfd pfd = {STDIN_FILENO, POLLIN, 0};
+    int ready = poll(&pfd, 1, timeout_ms);
+    if (ready <= 0)
+    {
+        decode_input_bytes(true);
+        return input_head != input_tail;
+    }
 
-void spawn_enemies() // Function definition
-{
-    bool boss_alive = false;
-    for (int i = 0; i < enemy_count; i++)
+    while (input_byte_count < (int)sizeof(input_bytes))
     {
-        if (enemies[i].is_boss)
+        ssize_t n = read(STDIN_FILENO, input_bytes + input_byte_count, sizeof(input_bytes) - input_byte_count);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
         {
-            boss_alive = true;
+            if (n == 0 && !raw_mode_enabled)
+                exit(0); // stdin closed (piped input ran out)
             break;
         }
+        input_byte_count += n;
+        if (!raw_mode_enabled)
+            break; // Cooked/pipe input: one read per pump keeps read() from blocking
     }
+    decode_input_bytes(false);
 
-    if (boss_alive || enemy_count >= MAX_ENEMIES)
-        return;
+    // Give the rest of a split escape sequence a moment to arrive
+    if (input_byte_count > 0 && poll(&pfd, 1, 10) <= 0)
+        decode_input_bytes(true);
+    return input_head != input_tail;
+#endif
+}
 
-    float progress_factor = 1 + (world_offset / 80.0f);
-    int enemies_to_spawn = 3 + rand() % 3;
+bool poll_key(int *key) // Function definition
+{
+    if (input_head == input_tail && !pump_input(0))
+        return false;
+    *key = input_queue[input_head];
+    input_head = (input_head + 1) % INPUT_QUEUE_SIZE;
+    return true;
+}
 
-    for (int i = 0; i < enemies_to_spawn && enemy_count < MAX_ENEMIES; i++)
+int wait_key() // Function definition
+{
+    while (input_head == input_tail)
     {
-        int x, y;
-        do
-        {
-            x = 1 + rand() % (MAP_WIDTH - 2);
-            y = 1 + rand() % (MAP_HEIGHT - 2);
-        } while (game_map[y][x] != '_' ||
-                 abs(x - player.x) < 5 ||
-                 abs(y - player.y) < 5);
-
-        enemies[enemy_count] = (Enemy){
-            x, y,
-            (int)(10 * progress_factor),
-            (int)(4 * progress_factor),
-            (int)(5 * progress_factor),
-            false};
-        enemy_count++;
+        pump_input(-1);
     }
+    int key = input_queue[input_head];
+    input_head = (input_head + 1) % INPUT_QUEUE_SIZE;
+    return key;
 }
 
-void move_enemies() // Function definition
+// Arrow keys map onto the WASD bindings the menus and game already use
+char key_to_char(int key) // Function definition
 {
-    for (int i = 0; i < enemy_count; i++)
+    switch (key)
     {
-        int dx = player.x - enemies[i].x;
-        int dy = player.y - enemies[i].y;
-
-        if (abs(dx) <= 5 && abs(dy) <= 5)
-        {
-            if (abs(dx) > abs(dy))
-            {
-                if (dx > 0 && game_map[enemies[i].y][enemies[i].x + 1] == '_')
-                    enemies[i].x++;
-                else if (dx < 0 && game_map[enemies[i].y][enemies[i].x - 1] == '_') // Function definition
-                    enemies[i].x--;
-            }
-            else
-            {
-                if (dy > 0 && game_map[enemies[i].y + 1][enemies[i].x] == '_')
-                    enemies[i].y++;
-                else if (dy < 0 && game_map[enemies[i].y - 1][enemies[i].x] == '_') // Function definition
-                    enemies[i].y--;
-            }
-        }
-        else
-        {
-            int dir = rand() % 4;
-            switch (dir)
-            {
-            case 0:
-                if (game_map[enemies[i].y - 1][enemies[i].x] == '_')
-                    enemies[i].y--;// move down
-                break;
-            case 1:
-                if (game_map[enemies[i].y + 1][enemies[i].x] == '_')
-                    enemies[i].y++;// move up
-                break;
-            case 2:
-                if (game_map[enemies[i].y][enemies[i].x - 1] == '_')
-                    enemies[i].x--;// move left
-                break;
-            case 3:
-                if (game_map[enemies[i].y][enemies[i].x + 1] == '_')
-                    enemies[i].x++;// move right
-                break;
-            }
-        }
+    case KEY_UP:
+        return 'w';
+    case KEY_DOWN:
+        return 's';
+    case KEY_RIGHT:
+        return 'd';
+    case KEY_LEFT:
+        return 'a';
     }
+    return (char)key;
 }
 
-void check_collisions() // Function definition
+char get_key() // Function definition
 {
-    for (int i = 0; i < enemy_count; i++)
-    {
-        if (player.x == enemies[i].x && player.y == enemies[i].y)
-        {
-            // Player attacks enemy
-            enemies[i].hp -= player.strength;
-
-            if (enemies[i].hp <= 0)
-            {
-                player.xp += enemies[i].xp_value;
+    return key_to_char(wait_key());
+}
 
-                if (enemies[i].is_boss)
-                {
-                    clear_messages();
-                    display_message("VICTORY! Boss defeated!", MSG_LINE_1, true);
-                    display_message("You feel stronger!", MSG_LINE_2, true);
-                    player.strength += 5;
-                    draw_game();
-                    msleep(3500);
-                }
+#ifdef _WIN32
+void enable_ansi() // Function definition
+{
+    HANDLE hOut = GetStdHandle(STD_OUTPUT_HANDLE);
+    if (hOut == INVALID_HANDLE_VALUE)
+        return;
 
-                // Remove defeated enemy
-                for (int j = i; j < enemy_count - 1; j++)
-                {
-                    enemies[j] = enemies[j + 1];
-                }
-                enemy_count--;
-                i--;
+    DWORD dwMode = 0;
+    if (!GetConsoleMode(hOut, &dwMode))
+        return;
 
-                // Check for level up
-                if (player.xp >= player.xp_to_level)
-                {
-                    player.level++;
-                    player.xp -= player.xp_to_level;
-                    player.xp_to_level = (int)(player.xp_to_level * 1.5);
-                    player.max_hp += 5;
-                    player.hp = player.max_hp;
-                    player.strength += 2;
-                }
-            }
-            else
-            {
-                // Enemy attacks player
-                player.hp -= enemies[i].strength;
+#ifndef ENABLE_VIRTUAL_TERMINAL_PROCESSING
+#define ENABLE_VIRTUAL_TERMINAL_PROCESSING 0x0004 // Game constant definition
+#endif
 
-                // Immediate death check and handling
-                if (player.hp <= 0)
-                {
-                    player.hp = 0; // Prevent negative HP
-                    return;        // Exit immediately
-                }
-            }
-            break;
-        }
-    }
+    dwMode |= ENABLE_VIRTUAL_TERMINAL_PROCESSING;
+    SetConsoleMode(hOut, dwMode);
 }
+#endif
 
-// Display implementations
-// Modified draw_game() function with better player stats display
-void draw_game() // Function definition
+// Sub-millisecond sleep where the platform has one (the real-time loop's waits are short)
+void sleep_seconds(double seconds) // Function definition
 {
-    clear_screen();
-    bool is_boss_room = (world_offset >= 200) && (world_offset % 200 == 0);
+    if (seconds <= 0)
+        return;
+#ifdef _WIN32
+    Sleep((DWORD)(seconds * 1000.0 + 0.999));
+#else
+    struct timespec wait = {(time_t)seconds, (long)((seconds - (time_t)seconds) * 1e9)};
+    while (nanosleep(&wait, &wait) != 0 && errno == EINTR)
+        ;
+#endif
+}
 
-    // Draw map
-    for (int y = 0; y < MAP_HEIGHT; y++)
+// Render sink implementations
+bool stdout_sink_write(RenderSink *sink, const char *data, size_t length) // Function definition
+{
+#ifdef _WIN32
+    (void)sink;
+    bool ok = fwrite(data, 1, length, stdout) == length;
+    fflush(stdout);
+    return ok;
+#else
+    size_t written = 0;
+    while (written < length)
     {
-        for (int x = 0; x < MAP_WIDTH; x++)
+        ssize_t n = write(sink->fd, data + written, length - written);
+        if (n < 0)
         {
-            move_cursor(x, y);
-            if (is_boss_room && x >= MAP_WIDTH / 2 - 5 && x <= MAP_WIDTH / 2 + 5)
-            {
-                printf("\033[48;5;52m");
-            }
-            if (game_map[y][x] == '~')
-            {
-                printf("\033[0;36m~\033[0m");
-            }
-            else
-            {
-                putchar(game_map[y][x]);
-            }
-            printf("\033[0m");
+            if (errno == EINTR)
+                continue;
+            return false; // Terminal went away, drop the frame
         }
+        written += n;
     }
+    return true;
+#endif
+}
 
-    // Draw player
-    move_cursor(player.x, player.y);
-    printf("\033[1;37m@\033[0m");
+bool null_sink_write(RenderSink *sink, const char *data, size_t length) // Function definition
+{
+    (void)sink;
+    (void)data;
+    (void)length;
+    return true;
+}
 
-    // Draw enemies
-    for (int i = 0; i < enemy_count; i++)
+bool memory_sink_write(RenderSink *sink, const char *data, size_t length) // Function definition
+{
+    if (sink->memory_length + length > sink->memory_capacity)
     {
-        move_cursor(enemies[i].x, enemies[i].y);
-        if (enemies[i].is_boss)
-        {
-            printf("\033[1;33mB\033[0m");
-        }
-        else
-        {
-            printf("\033[0;91me\033[0m");
-        }
+        size_t capacity = sink->memory_capacity ? sink->memory_capacity : 4096;
+        while (capacity < sink->memory_length + length)
+            capacity *= 2;
+        char *grown = realloc(sink->memory, capacity);
+        if (!grown)
+            return false;
+        sink->memory = grown;
+        sink->memory_capacity = capacity;
     }
+    memcpy(sink->memory + sink->memory_length, data, length);
+    sink->memory_length += length;
+    return true;
+}
 
-    // Enhanced player stats display
-    move_cursor(0, MAP_HEIGHT);
-    printf("\033[1;36mPlayer: %s\033[0m", player.name);
+void memory_sink_close(RenderSink *sink) // Function definition
+{
+    free(sink->memory);
+    sink->memory = NULL;
+    sink->memory_length = sink->memory_capacity = 0;
+}
 
-    move_cursor(0, MAP_HEIGHT + 1);
-    printf("\033[1;33mHP: %d/%d | STR: %d | LVL: %d | XP: %d/%d | Score: %d\033[0m",
-           player.hp, player.max_hp, player.strength, player.level,
-           player.xp, player.xp_to_level, player.score);
+bool file_sink_write(RenderSink *sink, const char *data, size_t length) // Function definition
+{
+    return fwrite(data, 1, length, sink->file) == length;
+}
 
-    move_cursor(0, MAP_HEIGHT + 2);
-    printf("\033[1;37mControls: WASD to move, P to save, Q to quit\033[0m");
+void file_sink_close(RenderSink *sink) // Function definition
+{
+    if (sink->file)
+        fclose(sink->file);
+    sink->file = NULL;
+}
 
-    // Nearby enemies display
-    int stat_line = MAP_HEIGHT + 3;
-    move_cursor(0, stat_line);
-    printf("\033[1;31mNearby enemies: \033[0m");
+// Selects the output backend: "stdout", "null", "memory" or "file:PATH"
+bool open_render_sink(const char *spec) // Function definition
+{
+    close_render_sink();
+    memset(&render_sink, 0, sizeof(render_sink));
 
-    int visible_count = 0;
-    for (int i = 0; i < enemy_count && visible_count < 2; i++)
+    if (strcmp(spec, "stdout") == 0)
     {
-        if (abs(enemies[i].x - player.x) <= 3 &&
-            abs(enemies[i].y - player.y) <= 3)
-        {
-            move_cursor(0, stat_line + 1 + visible_count);
-            printf("%s \033[1;31mHP:\033[0m%-3d \033[1;31mSTR:\033[0m%-2d",
-                   enemies[i].is_boss ? "\033[1;33mBOSS\033[0m" : "\033[0;91mEnemy\033[0m",
-                   enemies[i].hp,
-                   enemies[i].strength);
-            visible_count++;
-        }
+        render_sink.name = "stdout";
+        render_sink.write = stdout_sink_write;
+#ifndef _WIN32
+        render_sink.fd = STDOUT_FILENO;
+#endif
     }
-
-    for (int i = visible_count; i < 2; i++)
+    else if (strcmp(spec, "null") == 0)
     {
-        move_cursor(0, stat_line + 1 + i);
-        printf("                ");
+        render_sink.name = "null";
+        render_sink.write = null_sink_write;
     }
-
-    if (visible_count == 0)
+    else if (strcmp(spec, "memory") == 0)
     {
-        move_cursor(16, stat_line);
-        printf("\033[0;37mNone\033[0m");
+        render_sink.name = "memory";
+        render_sink.write = memory_sink_write;
+        render_sink.close = memory_sink_close;
     }
-
-    fflush(stdout);
+    else if (strncmp(spec, "file:", 5) == 0 && spec[5] != '\0')
+    {
+        render_sink.file = fopen(spec + 5, "wb");
+        if (!render_sink.file)
+            return false;
+        setvbuf(render_sink.file, NULL, _IOFBF, FILE_SINK_BUFFER_SIZE);
+        render_sink.name = "file";
+        render_sink.write = file_sink_write;
+        render_sink.close = file_sink_close;
+    }
+    else
+    {
+        return false;
+    }
+    return true;
 }
 
-void show_welcome_screen() // Function definition
+void close_render_sink() // Function definition
 {
-    clear_screen();
-    move_cursor(MAP_WIDTH / 2 - 10, MAP_HEIGHT / 2 - 2);
-    printf("\033[1;35mWelcome to RougeByte!\033[0m");
-    move_cursor(MAP_WIDTH / 2 - 10, MAP_HEIGHT / 2 - 1);
-    printf("\033[0;36mBeat your best steps!\033[0m");
-    fflush(stdout);
-    msleep(3000);
+    output_flush();
+    if (render_sink.close)
+        render_sink.close(&render_sink);
+    render_sink.close = NULL;
 }
 
-int show_main_menu(bool has_save) // Function definition
+// Closes the current frame: pushes buffered output to the sink and rolls the per-frame counters
+void end_frame() // Function definition
 {
-    clear_screen();
-    int selected = 0;
-    int option_count = has_save ? 4 : 3; // 4 options if save exists, 3 otherwise
-    char options[4][20] = {
-        "Continue",
-        "New Game",
-        "Leaderboard",
-        "Exit"};
-
-    while (1)
-    {
-        clear_screen();
-        move_cursor(MAP_WIDTH / 2 - 8, MAP_HEIGHT / 2 - 3);
-        printf("\033[1;34mMAIN MENU\033[0m");
-
-        // Only show Continue if save exists
-        int start_index = has_save ? 0 : 1;
+    output_flush();
+    if (render_sink.frame_bytes == 0 && render_sink.frame_flushes == 0)
+        return;
 
-        for (int i = 0; i < option_count; i++)
-        {
-            move_cursor(MAP_WIDTH / 2 - 8, MAP_HEIGHT / 2 - 1 + i);
-            if (i == selected)
-            {
-                printf("\033[1;32m> %s\033[0m", options[start_index + i]);
-            }
-            else
-            {
-                printf("  %s", options[start_index + i]);
-            }
-        }
+    render_sink.frames++;
+    render_sink.last_frame_bytes = render_sink.frame_bytes;
+    render_sink.last_frame_flushes = render_sink.frame_flushes;
+    if (render_sink.frame_bytes > render_sink.max_frame_bytes)
+        render_sink.max_frame_bytes = render_sink.frame_bytes;
+    render_sink.frame_bytes = 0;
+    render_sink.frame_flushes = 0;
+}
 
-        char ch = getch();
-        if (ch == 'w' || ch == 'W')
-        {
-            selected = (selected - 1 + option_count) % option_count;
-        }
-        else if (ch == 's' || ch == 'S') 
-        {
-            selected = (selected + 1) % option_count;
-        }
-        else if (ch == '\r' || ch == '\n') 
-        {
-            return has_save ? selected : selected + 1; // Adjust return value
-        }
-    }
+void report_render_sink(FILE *stream) // Function definition
+{
+    unsigned long long frames = render_sink.frames ? render_sink.frames : 1;
+    fprintf(stream, "sink=%s frames=%llu bytes=%llu flushes=%llu "
+                    "bytes/frame=%.1f flushes/frame=%.2f max_frame_bytes=%llu\n",
+            render_sink.name, render_sink.frames,
+            render_sink.total_bytes, render_sink.total_flushes,
+            (double)render_sink.total_bytes / frames,
+            (double)render_sink.total_flushes / frames,
+            render_sink.max_frame_bytes);
 }
-// Leaderboard implementations
-void load_leaderboard() // Function definition
+
+// Frame renderer implementations
+// SGR sequences for each CellColor; every entry starts from a reset so switching never leaks attributes
+const char *color_codes[COLOR_COUNT] = {
+    "\033[0m",          // COLOR_DEFAULT
+    "\033[0;48;5;52m",  // COLOR_BOSS_ROOM
+    "\033[0;36m",       // COLOR_CYAN
+    "\033[0;1;37m",     // COLOR_BRIGHT_WHITE
+    "\033[0;1;33m",     // COLOR_BRIGHT_YELLOW
+    "\033[0;91m",       // COLOR_LIGHT_RED
+    "\033[0;1;36m",     // COLOR_BRIGHT_CYAN
+    "\033[0;1;31m",     // COLOR_BRIGHT_RED
+    "\033[0;37m"};      // COLOR_GRAY
+
+void output_append(const char *data, size_t length) // Function definition
 {
-    FILE *file = fopen(get_leaderboard_path(), "r");
-    if (!file)
+    if (output_length + length > OUTPUT_BUFFER_SIZE)
     {
-        leaderboard_size = 0;
-        return;
+        output_flush();
+        if (length > OUTPUT_BUFFER_SIZE)
+            length = OUTPUT_BUFFER_SIZE;
     }
+    memcpy(output_buffer + output_length, data, length);
+    output_length += length;
+}
 
-    leaderboard_size = 0;
-    while (fscanf(file, "%50s %d %d",
-                  leaderboard[leaderboard_size].name,
-                  &leaderboard[leaderboard_size].level,
-                  &leaderboard[leaderboard_size].distance) == 3 &&
-           leaderboard_size < MAX_LEADERBOARD)
-    {
-        leaderboard_size++;
-    }
-    fclose(file);
+void output_printf(const char *format, ...) // Function definition
+{
+    char text[256];
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(text, sizeof(text), format, args);
+    va_end(args);
+    if (length < 0)
+        return;
+    if (length >= (int)sizeof(text))
+        length = sizeof(text) - 1;
+    output_append(text, length);
 }
 
-bool update_leaderboard_entries() // Function definition
+void output_flush() // Function definition
 {
-    for (int i = 0; i < leaderboard_size; i++)
-    {
-        if (strlen(leaderboard[i].name) == 0 ||
-            leaderboard[i].level <= 0 ||
-            leaderboard[i].distance < 0)
-        {
-            return false;
-        }
-    }
+    if (output_length == 0)
+        return;
+
+    render_sink.write(&render_sink, output_buffer, output_length);
+    render_sink.total_bytes += output_length;
+    render_sink.frame_bytes += output_length;
+    render_sink.total_flushes++;
+    render_sink.frame_flushes++;
+    output_length = 0;
+}
 
-    bool exists = false;
-    for (int i = 0; i < leaderboard_size; i++)
+void clear_back_buffer() // Function definition
+{
+    for (int y = 0; y < screen_height; y++)
     {
-        if (strcmp(leaderboard[i].name, player.name) == 0)
+        for (int x = 0; x < screen_width; x++)
         {
-            if (player.score > leaderboard[i].distance)
-            {
-                leaderboard[i].level = player.level;
-                leaderboard[i].distance = player.score;
-            }
-            exists = true;
-            break;
+            back_buffer[y][x] = (ScreenCell){' ', COLOR_DEFAULT};
         }
     }
+}
 
-    if (!exists)
-    {
-        if (leaderboard_size < MAX_LEADERBOARD)
-        {
-            strncpy(leaderboard[leaderboard_size].name, player.name, 4);
-            leaderboard[leaderboard_size].level = player.level;
-            leaderboard[leaderboard_size].distance = player.score;
-            leaderboard_size++;
-        }
-        else
-        {
-            int lowest_index = 0;
-            for (int i = 1; i < leaderboard_size; i++)
-            {
-                if (leaderboard[i].distance < leaderboard[lowest_index].distance)
-                {
-                    lowest_index = i;
-                }
-            }
+void put_cell(int x, int y, char glyph, CellColor color) // Function definition
+{
+    if (x < 0 || x >= screen_width || y < 0 || y >= screen_height)
+        return;
+    back_buffer[y][x] = (ScreenCell){glyph, (unsigned char)color};
+}
 
-            if (player.score > leaderboard[lowest_index].distance)
-            {
-                strncpy(leaderboard[lowest_index].name, player.name, 50);
-                leaderboard[lowest_index].level = player.level;
-                leaderboard[lowest_index].distance = player.score;
-            }
-        }
-    }
+// Writes formatted text into the back buffer and returns the column after it
+int put_text(int x, int y, CellColor color, const char *format, ...) // Function definition
+{
+    char text[MAX_SCREEN_WIDTH + 1];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(text, sizeof(text), format, args);
+    va_end(args);
 
-    // Sort leaderboard
-    for (int i = 0; i < leaderboard_size - 1; i++)
+    for (int i = 0; text[i] != '\0'; i++)
     {
-        for (int j = 0; j < leaderboard_size - i - 1; j++)
-        {
-            if (leaderboard[j].distance < leaderboard[j + 1].distance ||
-                (leaderboard[j].distance == leaderboard[j + 1].distance &&
-                 leaderboard[j].level < leaderboard[j + 1].level))
-            {
-                LeaderboardEntry temp = leaderboard[j];
-                leaderboard[j] = leaderboard[j + 1];
-                leaderboard[j + 1] = temp;
-            }
-        }
+        put_cell(x++, y, text[i], color);
     }
-    return true;
+    return x;
 }
 
-void add_to_leaderboard()
-{ // Function definition
-    // printf("\nDEBUG: Attempting to add %s with score %d\n", player.name, player.score);
-
-    // Load current leaderboard first
-    load_leaderboard();
+void invalidate_front_buffer() // Function definition
+{
+    front_buffer_valid = false;
+}
 
-    // Check if player already exists
-    bool exists = false;
-    for (int i = 0; i < leaderboard_size; i++)
+// Sends only the cells that differ between the back and front buffers, in one write
+void present_frame() // Function definition
+{
+    if (!front_buffer_valid)
     {
-        if (strcmp(leaderboard[i].name, player.name) == 0)
+        output_printf("\033[0m\033[2J\033[H");
+        for (int y = 0; y < screen_height; y++)
         {
-            if (player.score > leaderboard[i].distance)
+            for (int x = 0; x < screen_width; x++)
             {
-                leaderboard[i].distance = player.score;
-                leaderboard[i].level = player.level;
-                // printf("DEBUG: Updated existing entry\n");
+                front_buffer[y][x] = (ScreenCell){' ', COLOR_DEFAULT};
             }
-            exists = true;
-            break;
         }
+        front_buffer_valid = true;
     }
 
-    // Add new entry if needed
-    if (!exists)
+    int cursor_x = -1, cursor_y = -1;
+    int current_color = -1; // Unknown until the first change is emitted
+    bool changed = false;
+
+    for (int y = 0; y < screen_height; y++)
     {
-        if (leaderboard_size < MAX_LEADERBOARD)
-        {
-            strncpy(leaderboard[leaderboard_size].name, player.name, 49);
-            leaderboard[leaderboard_size].level = player.level;
-            leaderboard[leaderboard_size].distance = player.score;
-            leaderboard_size++;
-            // printf("DEBUG: Added new entry\n");
-        }
-        else
+        for (int x = 0; x < screen_width; x++)
         {
-            // Find lowest score to replace
-            int lowest_index = 0;
-            for (int i = 1; i < leaderboard_size; i++)
-            {
-                if (leaderboard[i].distance < leaderboard[lowest_index].distance)
-                {
-                    lowest_index = i;
-                }
-            }
-            if (player.score > leaderboard[lowest_index].distance)
+            ScreenCell cell = back_buffer[y][x];
+            if (cell.glyph == front_buffer[y][x].glyph &&
+                cell.color == front_buffer[y][x].color)
+                continue;
+
+            if (cursor_x != x || cursor_y != y)
+                output_printf("\033[%d;%dH", y + 1, x + 1);
+            if (cell.color != current_color)
             {
-                strncpy(leaderboard[lowest_index].name, player.name, 49);
-                leaderboard[lowest_index].level = player.level;
-                leaderboard[lowest_index].distance = player.score;
-                // printf("DEBUG: Replaced lowest entry\n");
+                output_append(color_codes[cell.color], strlen(color_codes[cell.color]));
+                current_color = cell.color;
             }
+            output_append(&cell.glyph, 1);
+            front_buffer[y][x] = cell;
+            cursor_x = x + 1;
+            cursor_y = y;
+            changed = true;
         }
     }
 
-    // Sort the leaderboard
-    for (int i = 0; i < leaderboard_size - 1; i++)
+    if (changed)
     {
-        for (int j = 0; j < leaderboard_size - i - 1; j++)
-        {
-            if (leaderboard[j].distance < leaderboard[j + 1].distance ||
-                (leaderboard[j].distance == leaderboard[j + 1].distance &&
-                 leaderboard[j].level < leaderboard[j + 1].level))
-            {
-                LeaderboardEntry temp = leaderboard[j];
-                leaderboard[j] = leaderboard[j + 1];
-                leaderboard[j + 1] = temp;
-            }
-        }
+        if (current_color != COLOR_DEFAULT)
+            output_printf("%s", color_codes[COLOR_DEFAULT]);
+        output_printf("\033[%d;1H", screen_height + 1); // Park the cursor below the HUD
     }
+    end_frame();
+}
 
-    // Save to file
-    char *path = get_leaderboard_path();
-    FILE *file = fopen(path, "w");
-    if (file)
+// Terminal size for the viewport; anything but a real console keeps the 80x24 default
+void query_terminal_size() // Function definition
+{
+#ifdef _WIN32
+    CONSOLE_SCREEN_BUFFER_INFO info;
+    if (GetConsoleScreenBufferInfo(GetStdHandle(STD_OUTPUT_HANDLE), &info))
     {
-        for (int i = 0; i < leaderboard_size; i++)
-        {
-            fprintf(file, "%s %d %d\n",
-                    leaderboard[i].name,
-                    leaderboard[i].level,
-                    leaderboard[i].distance);
-        }
-        fclose(file);
-        // printf("DEBUG: Leaderboard saved to %s\n", path);
+        terminal_width = info.srWindow.Right - info.srWindow.Left + 1;
+        terminal_height = info.srWindow.Bottom - info.srWindow.Top + 1;
     }
-    else
+#else
+    struct winsize size;
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &size) == 0 && size.ws_col > 0 && size.ws_row > 0)
     {
-        // printf("ERROR: Could not save leaderboard!\n");
+        terminal_width = size.ws_col;
+        terminal_height = size.ws_row;
     }
+#endif
 }
 
-void show_leaderboard()
+// Fits the viewport to the terminal (never larger than the map) and centres it on the player,
+// clamped so it never shows cells past the map edge
+void update_viewport(Game *game) // Function definition
+{
+    int width = terminal_width < MAX_SCREEN_WIDTH ? terminal_width : MAX_SCREEN_WIDTH;
+    int height = (terminal_height < MAX_SCREEN_HEIGHT ? terminal_height : MAX_SCREEN_HEIGHT) - HUD_LINES;
+    if (width > game->width)
+        width = game->width;
+    if (height > game->height)
+        height = game->height;
+    if (height < 1)
+        height = 1;
+
+    if (width != view.width || height != view.height)
+    {
+        view.width = width;
+        view.height = height;
+        screen_width = width > MIN_SCREEN_WIDTH ? width : MIN_SCREEN_WIDTH;
+        screen_height = height + HUD_LINES;
+        invalidate_front_buffer();
+    }
+
+    view.x = game->player.x - view.width / 2;
+    view.y = game->player.y - view.height / 2;
+    if (view.x > game->width - view.width)
+        view.x = game->width - view.width;
+    if (view.y > game->height - view.height)
+        view.y = game->height - view.height;
+    if (view.x < 0)
+        view.x = 0;
+    if (view.y < 0)
+        view.y = 0;
+}
+
+// Message system implementations
+// Drops every timed message; the HUD shows through again on the next frame
+void clear_messages() // Function definition
+{
+    for (int i = 0; i < MESSAGE_LINES; i++)
+    {
+        messages[i].active = false;
+    }
+}
+
+void display_message(const char *msg, int line, bool important) // Function definition
+{
+    if (important)
+    {
+#ifdef _WIN32
+        put_text(0, line, COLOR_DEFAULT, ">>> %-60s <<<", msg);
+#else
+        put_text(0, line, COLOR_BRIGHT_RED, ">>> %s <<<", msg);
+#endif
+    }
+    else
+    {
+        put_text(0, line, COLOR_DEFAULT, "%s", msg);
+    }
+    present_frame();
+}
+
+// Shows msg on a message line for at least seconds and at least turns more turns, while play
+// goes on. A later message on the same line replaces it.
+void post_message(Game *game, int line, CellColor color, const char *msg, double seconds, int turns) // Function definition
+{
+    int slot = line - MSG_LINE_1;
+    if (slot < 0 || slot >= MESSAGE_LINES)
+        return;
+    TimedMessage *message = &messages[slot];
+    snprintf(message->text, sizeof(message->text), "%s", msg);
+    message->color = color;
+    message->until = seconds > 0 ? now_seconds() + seconds : 0;
+    message->until_turn = turns > 0 ? game->turn_count + turns : 0;
+    message->active = true;
+}
+
+// Called by draw_game() before it presents the frame
+void draw_messages(Game *game) // Function definition
+{
+    double now = now_seconds();
+    for (int i = 0; i < MESSAGE_LINES; i++)
+    {
+        TimedMessage *message = &messages[i];
+        if (message->active && now >= message->until && game->turn_count >= message->until_turn)
+            message->active = false;
+        if (message->active)
+            put_text(0, MSG_LINE_1 + i, message->color, "%-60s", message->text);
+    }
+}
+
+// Milliseconds until a timed message is due to go (rounded up), -1 when none is waiting on the clock.
+// The turn-based loop waits for input at most this long so the message disappears on time.
+int message_wait_ms() // Function definition
+{
+    double now = now_seconds();
+    double next = 0;
+    for (int i = 0; i < MESSAGE_LINES; i++)
+    {
+        if (messages[i].active && messages[i].until > now && (next == 0 || messages[i].until < next))
+            next = messages[i].until;
+    }
+    return next > 0 ? (int)((next - now) * 1000.0 + 0.999) : -1;
+}
+
+// Waits up to timeout_ms for a key and throws it away; true when one came. Screens that used
+// to sleep wait here instead, so a key press moves on rather than queueing behind the sleep.
+bool wait_for_key(int timeout_ms) // Function definition
+{
+    double deadline = now_seconds() + timeout_ms / 1000.0;
+    int key;
+    while (!poll_key(&key))
+    {
+        double left = deadline - now_seconds();
+        if (left <= 0)
+            return false;
+        pump_input((int)(left * 1000.0 + 0.999));
+    }
+    return true;
+}
+
+// File path implementations
+char *get_leaderboard_path()
+{
+    static char path[256];
+    snprintf(path, sizeof(path), "leaderboard.dat"); // Force current directory
+    // printf("DEBUG: Leaderboard path: %s\n", path);
+    return path;
+}
+
+// Game results appended since the last compaction
+char *get_leaderboard_journal_path()
+{
+    static char path[256];
+    snprintf(path, sizeof(path), "leaderboard.journal"); // Force current directory
+    return path;
+}
+
+// Journal handed to the compaction thread; new results go to a fresh journal meanwhile
+char *get_retired_journal_path()
+{
+    static char path[256];
+    snprintf(path, sizeof(path), "leaderboard.journal.old"); // Force current directory
+    return path;
+}
+
+// Text leaderboard written by older versions, imported once when no leaderboard.dat exists
+char *get_legacy_leaderboard_path()
+{
+    static char path[256];
+    snprintf(path, sizeof(path), "leaderboard.txt"); // Force current directory
+    return path;
+}
+
+char *get_save_file_path()
+{
+    static char path[256];
+    snprintf(path, sizeof(path), "savegame.dat"); // Force current directory
+    // printf("DEBUG: Save file path: %s\n", path);
+    return path;
+}
+
+char *get_replay_path()
+{
+    static char path[256];
+    snprintf(path, sizeof(path), "%s", record_path ? record_path : "last_run.rbr"); // Force current directory
+    return path;
+}
+
+void ensure_directory_exists(const char *path)
 { // Function definition
-    int selected = 0;
+#ifndef _WIN32
+    // For Unix: Check if directory exists
+    char *sep = strrchr(path, '/');
+    if (sep)
+    {
+        char dirpath[256];
+        strncpy(dirpath, path, sep - path);
+        dirpath[sep - path] = '\0';
+        mkdir(dirpath, S_IRWXU); // Create if doesn't exist
+    }
+#endif
+}
+
+bool safe_rename(const char *oldpath, const char *newpath)
+{ // Function definition
+#ifdef _WIN32
+    // Windows needs special handling
+    remove(newpath); // Delete destination if exists
+#endif
+    return rename(oldpath, newpath) == 0; // Function definition
+}
+
+// Pushes stdio buffers and then the OS cache to disk
+bool sync_file(FILE *file)
+{ // Function definition
+    if (fflush(file) != 0)
+        return false;
+#ifdef _WIN32
+    return _commit(_fileno(file)) == 0;
+#else
+    return fsync(fileno(file)) == 0;
+#endif
+}
+
+// Game instance implementations
+const Balance default_balance = {80.0f, 40, 30, 8, 60, 80, 25, 1.5f};
+
+Game *create_game(bool headless) // Function definition
+{
+    Game *game = calloc(1, sizeof(Game));
+    if (!game)
+        return NULL;
+    if (!allocate_grid(game, world_option.width, world_option.height) ||
+        !(game->history = open_chunk_store(world_option.width)))
+    {
+        arena_free(&game->grid.arena);
+        free(game);
+        return NULL;
+    }
+    game->max_enemies = world_option.max_enemies;
+    game->enemies.free_slot = -1;
+    game->balance = balance_option;
+    game->headless = headless;
+    game->death_turn = -1;
+    reset_enemies(game);
+    return game;
+}
+
+void destroy_game(Game *game) // Function definition
+{
+    if (!game)
+        return;
+    free_enemy_pool(&game->enemies);
+    arena_free(&game->grid.arena);
+    close_chunk_store(game->history);
+    free(game);
+}
+
+// Zeroed block of capacity bytes
+bool arena_init(Arena *arena, size_t capacity) // Function definition
+{
+    arena->base = calloc(1, capacity);
+    arena->used = 0;
+    arena->capacity = arena->base ? capacity : 0;
+    return arena->base != NULL;
+}
+
+// Next size bytes, aligned to ARENA_ALIGN; NULL once the block is used up
+void *arena_alloc(Arena *arena, size_t size) // Function definition
+{
+    size_t start = (arena->used + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+    if (start > arena->capacity || size > arena->capacity - start)
+        return NULL;
+    arena->used = start + size;
+    return arena->base + start;
+}
+
+void arena_free(Arena *arena) // Function definition
+{
+    free(arena->base);
+    *arena = (Arena){0};
+}
+
+// Lays out every per-cell array for a width x height map in one arena. The layout depends
+// only on the size. The map still has to be generated or imported and the enemies reset.
+bool allocate_grid(Game *game, int width, int height) // Function definition
+{
+    if (width < MIN_MAP_WIDTH || width > MAX_MAP_SIZE || height < MIN_MAP_HEIGHT || height > MAX_MAP_SIZE)
+        return false;
+    int row_words = (width + 63) / 64;
+    size_t cells = (size_t)width * height;
+    size_t words = (size_t)row_words * height;
+    size_t capacity = cells * (sizeof(char) + sizeof(int) + sizeof(uint8_t)) + words * 5 * sizeof(uint64_t) +
+                      (size_t)ROWS_AHEAD * width + height * sizeof(int) + 9 * ARENA_ALIGN;
+
+    MapGrid grid = {0};
+    if (!arena_init(&grid.arena, capacity))
+        return false;
+    grid.map_rows = arena_alloc(&grid.arena, cells);
+    grid.occupancy = arena_alloc(&grid.arena, cells * sizeof(int));
+    grid.walkable = arena_alloc(&grid.arena, words * sizeof(uint64_t));
+    grid.occupied = arena_alloc(&grid.arena, words * sizeof(uint64_t));
+    grid.flow = arena_alloc(&grid.arena, cells);
+    grid.flow_reached = arena_alloc(&grid.arena, words * sizeof(uint64_t));
+    grid.flow_layers = arena_alloc(&grid.arena, 2 * words * sizeof(uint64_t));
+    grid.rows_ahead = arena_alloc(&grid.arena, (size_t)ROWS_AHEAD * width);
+    grid.spawn_counts = arena_alloc(&grid.arena, height * sizeof(int));
+
+    arena_free(&game->grid.arena);
+    game->grid = grid;
+    game->width = width;
+    game->height = height;
+    game->row_words = row_words;
+    game->map_head = 0;
+    game->ahead_next = game->ahead_count = 0;
+    game->flow_stale = true;
+    memset(grid.occupancy, 0xff, cells * sizeof(int)); // All -1
+    return true;
+}
+
+// Applies one --map-width / --map-height / --max-enemies value
+bool set_world_option(WorldSize *size, const char *name, const char *value) // Function definition
+{
+    char *end;
+    long number = strtol(value, &end, 10);
+    if (*value == '\0' || *end != '\0')
+        return false;
+    if (strcmp(name, "--map-width") == 0 && number >= MIN_MAP_WIDTH && number <= MAX_MAP_SIZE)
+        size->width = (int)number;
+    else if (strcmp(name, "--map-height") == 0 && number >= MIN_MAP_HEIGHT && number <= MAX_MAP_SIZE)
+        size->height = (int)number;
+    else if (strcmp(name, "--max-enemies") == 0 && number >= 0 && number <= MAX_ENEMIES)
+        size->max_enemies = (int)number;
+    else
+        return false;
+    return true;
+}
+
+// Random generator implementations
+void rng_seed(Rng *rng, uint64_t seed, uint64_t stream) // Function definition
+{
+    rng->state = 0;
+    rng->inc = (stream << 1u) | 1u;
+    rng_next(rng);
+    rng->state += seed;
+    rng_next(rng);
+}
+
+uint32_t rng_next(Rng *rng) // Function definition
+{
+    uint64_t old = rng->state;
+    rng->state = old * 6364136223846793005ULL + rng->inc;
+    uint32_t xorshifted = (uint32_t)(((old >> 18u) ^ old) >> 27u);
+    uint32_t rot = (uint32_t)(old >> 59u);
+    return (xorshifted >> rot) | (xorshifted << ((-rot) & 31));
+}
+
+// Uniform value in [0, bound) from the high bits, without a division
+uint32_t rng_range(Rng *rng, uint32_t bound) // Function definition
+{
+    return (uint32_t)(((uint64_t)rng_next(rng) * bound) >> 32);
+}
+
+// Same state as steps calls to rng_next(), in O(log steps) (Brown, "Random number generation
+// with arbitrary strides"). Steps wrap, so (uint64_t)-n goes back n draws.
+void rng_advance(Rng *rng, uint64_t steps) // Function definition
+{
+    uint64_t mult = 6364136223846793005ULL;
+    uint64_t plus = rng->inc;
+    uint64_t total_mult = 1;
+    uint64_t total_plus = 0;
+    while (steps)
+    {
+        if (steps & 1)
+        {
+            total_mult *= mult;
+            total_plus = total_plus * mult + plus;
+        }
+        plus = (mult + 1) * plus;
+        mult *= mult;
+        steps >>= 1;
+    }
+    rng->state = total_mult * rng->state + total_plus;
+}
+
+void seed_game_random(Game *game, uint64_t seed) // Function definition
+{
+    game->rng.seed = seed;
+    rng_seed(&game->rng.map, seed, 1);
+    rng_seed(&game->rng.spawn, seed, 2);
+    rng_seed(&game->rng.ai, seed, 3);
+    rng_seed(&game->rng.policy, seed, 4);
+    game->map_origin = game->rng.map;
+}
+
+// The --seed value when given, otherwise something different every run
+uint64_t pick_run_seed() // Function definition
+{
+    if (seed_option_set)
+        return seed_option;
+    uint64_t seed = (uint64_t)time(NULL) * 6364136223846793005ULL;
+    seed ^= (uint64_t)(now_seconds() * 1e9);
+    return seed;
+}
+
+// Game initialization implementations
+void init_player(Game *game) // Function definition
+{
+    game->player.x = game->width / 2;
+    game->player.y = game->height / 2;
+    game->player.max_hp = 20;
+    game->player.hp = game->player.max_hp;
+    game->player.strength = 5;
+    game->player.level = 1;
+    game->player.xp = 0;
+    game->player.xp_to_level = 10;
+    game->player.score = 0;
+}
+
+// Builds a whole row from bitmasks instead of a roll and a branch per cell. Each interior cell
+// gets a 15-bit lane of a 64-bit random word, four cells per word; one SWAR subtract compares
+// all four lanes against the 5% ('[') and 10% ('~') thresholds at once, and the lane results
+// are packed into per-row masks. Bracket pairs are then resolved with ctz over the sparse
+// bracket mask: a '[' takes the next cell as its ']' (that cell's roll is discarded), and a '['
+// on the last interior cell stays floor, as before.
+void generate_row_tiles(char *row, int width, Rng *rng, bool boss_room, bool boss_line) // Function definition
+{
+    const uint64_t lane_low = 0x0001000100010001ULL;
+    const uint64_t lane_top = 0x8000800080008000ULL;
+    const uint64_t bracket_limit = 1639 * lane_low; // 1639 / 32768 = 5%
+    const uint64_t water_limit = 3277 * lane_low;   // 3277 / 32768 = 10%
+
+    if (width < MIN_MAP_WIDTH || width > MAX_MAP_SIZE)
+        return; // allocate_grid() never makes such a row
+    int row_words = (width + 63) / 64;
+    uint64_t bracket[MAX_ROW_WORDS];
+    uint64_t water[MAX_ROW_WORDS];
+    memset(bracket, 0, row_words * sizeof(uint64_t));
+    memset(water, 0, row_words * sizeof(uint64_t));
+    for (int x = 0; x < width; x += 4)
+    {
+        uint64_t lanes = ((uint64_t)rng_next(rng) << 32 | rng_next(rng)) & ~lane_top;
+        uint64_t below_bracket = ~((lanes | lane_top) - bracket_limit) & lane_top;
+        uint64_t below_water = ~((lanes | lane_top) - water_limit) & lane_top;
+        // Lane top bits 15, 31, 47, 63 -> bits 0..3
+        uint64_t bracket_bits = ((below_bracket >> 15) * 0x0000200040008001ULL >> 45) & 0xF;
+        uint64_t water_bits = ((below_water >> 15) * 0x0000200040008001ULL >> 45) & 0xF;
+        bracket[x / 64] |= bracket_bits << (x % 64);
+        water[x / 64] |= water_bits << (x % 64);
+    }
+
+    // Walls never roll; neither does the middle of a boss room
+    for (int w = 0; w < row_words; w++)
+    {
+        uint64_t rolls = column_span(1, width - 2, w);
+        if (boss_room)
+            rolls &= ~column_span(width / 2 - 5, width / 2 + 5, w);
+        bracket[w] &= rolls;
+        water[w] &= rolls;
+    }
+
+    memset(row, '_', width);
+    row[0] = '|';
+    row[width - 1] = '|';
+    if (boss_room && boss_line)
+        memset(row + width / 2 - 5, 'B', 11);
+
+    uint64_t consumed = 0; // Cell taken by the ']' of a pair that started in the previous word
+    for (int w = 0; w < row_words; w++)
+    {
+        uint64_t starts = bracket[w] & ~consumed;
+        uint64_t taken = consumed;
+        consumed = 0;
+        while (starts)
+        {
+            int bit = __builtin_ctzll(starts);
+            int x = w * 64 + bit;
+            starts &= ~(1ULL << bit);
+            if (x >= width - 2)
+                continue; // No room for the ']'
+            row[x] = '[';
+            row[x + 1] = ']';
+            if (bit == 63)
+            {
+                consumed = 1;
+            }
+            else
+            {
+                taken |= 1ULL << (bit + 1);
+                starts &= ~(1ULL << (bit + 1));
+            }
+        }
+
+        uint64_t pools = water[w] & ~bracket[w] & ~taken;
+        while (pools)
+        {
+            int bit = __builtin_ctzll(pools);
+            pools &= pools - 1;
+            row[w * 64 + bit] = '~';
+        }
+    }
+}
+
+void generate_new_row(Game *game, int y) // Function definitionww
+{
+    bool is_boss_room = (game->world_offset >= 200) && (game->world_offset % 200 == 0);
+    generate_row_tiles(map_row(game, y), game->width, &game->rng.map, is_boss_room, y == game->height / 2);
+    update_walkable_row(game, y);
+}
+
+// Generates the next ROWS_AHEAD scroll rows in one go. Rows come off the map stream in the
+// same order either way, so the batch size never changes what a seed plays like.
+void fill_rows_ahead(Game *game) // Function definition
+{
+    for (int i = 0; i < ROWS_AHEAD; i++)
+    {
+        int offset = game->furthest_offset + i; // world_offset when this row scrolls in
+        bool is_boss_room = (offset >= 200) && (offset % 200 == 0);
+        game->ahead_rng[i] = game->rng.map;
+        generate_row_tiles(game->grid.rows_ahead + (size_t)i * game->width, game->width, &game->rng.map, is_boss_room, false);
+    }
+    game->ahead_next = 0;
+    game->ahead_count = ROWS_AHEAD;
+}
+
+// New top row for a scroll, taken from the rows generated ahead
+void scroll_in_row(Game *game) // Function definition
+{
+    if (game->ahead_next >= game->ahead_count)
+        fill_rows_ahead(game);
+    memcpy(map_row(game, 0), game->grid.rows_ahead + (size_t)game->ahead_next++ * game->width, game->width);
+    update_walkable_row(game, 0);
+}
+
+void init_map(Game *game) // Function definition
+{
+    game->map_head = 0;
+    game->ahead_next = game->ahead_count = 0;
+    game->flow_stale = true;
+    for (int y = 0; y < game->height; y++)
+    {
+        generate_new_row(game, y);
+    }
+}
+
+// Map access implementations
+// Physical ring-buffer row holding logical row y (0 = top of the map)
+int map_row_index(Game *game, int y) // Function definition
+{
+    int index = game->map_head + y;
+    if (index >= game->height)
+        index -= game->height;
+    return index;
+}
+
+char *map_row(Game *game, int y) // Function definition
+{
+    return game->grid.map_rows + (size_t)map_row_index(game, y) * game->width;
+}
+
+// Tile at a logical position; anything off the map reads as wall
+char tile_at(Game *game, int x, int y) // Function definition
+{
+    if (x < 0 || x >= game->width || y < 0 || y >= game->height)
+        return '|';
+    return map_row(game, y)[x];
+}
+
+// Copies the map out in logical row order, height rows of width tiles
+void export_map(Game *game, char *dst) // Function definition
+{
+    for (int y = 0; y < game->height; y++)
+    {
+        memcpy(dst + (size_t)y * game->width, map_row(game, y), game->width);
+    }
+}
+
+void import_map(Game *game, const char *src) // Function definition
+{
+    game->map_head = 0;
+    memcpy(game->grid.map_rows, src, (size_t)game->width * game->height);
+    game->flow_stale = true;
+    for (int y = 0; y < game->height; y++)
+    {
+        update_walkable_row(game, y);
+    }
+}
+
+// Walkability masks
+// Every write of a map row goes through here, so the masks always match the tiles
+void update_walkable_row(Game *game, int y) // Function definition
+{
+    const char *row = map_row(game, y);
+    uint64_t *bits = game->grid.walkable + (size_t)map_row_index(game, y) * game->row_words;
+    memset(bits, 0, game->row_words * sizeof(uint64_t));
+    for (int x = 0; x < game->width; x++)
+    {
+        bits[x / 64] |= (uint64_t)(row[x] == '_') << (x % 64);
+    }
+}
+
+// Same answer as tile_at(game, x, y) == '_' with one bit test
+bool is_walkable(Game *game, int x, int y) // Function definition
+{
+    if (x < 0 || x >= game->width || y < 0 || y >= game->height)
+        return false;
+    return (game->grid.walkable[(size_t)map_row_index(game, y) * game->row_words + x / 64] >> (x % 64)) & 1;
+}
+
+// Bits of columns first..last that fall into the given 64-column word of a row mask
+uint64_t column_span(int first, int last, int word) // Function definition
+{
+    int low = first > word * 64 ? first - word * 64 : 0;
+    int high = last < word * 64 + 63 ? last - word * 64 : 63;
+    if (low > high)
+        return 0;
+    return (~0ULL >> (63 - (high - low))) << low;
+}
+
+// World history implementations
+ChunkStore *open_chunk_store(int width) // Function definition
+{
+    ChunkStore *store = calloc(1, sizeof(ChunkStore));
+    Rng none = {0, 0};
+    if (store && !reset_chunk_store(store, width, &none))
+    {
+        free(store);
+        return NULL;
+    }
+    return store;
+}
+
+void close_chunk_store(ChunkStore *store) // Function definition
+{
+    if (!store)
+        return;
+    if (store->data)
+        fclose(store->data); // tmpfile() files are deleted on close
+    if (store->index)
+        fclose(store->index);
+    free(store->slots);
+    free(store->record.data);
+    free(store);
+}
+
+// Forgets every chunk and sizes the slots for width-tile rows within --chunk-budget
+bool reset_chunk_store(ChunkStore *store, int width, const Rng *origin) // Function definition
+{
+    if (store->data)
+        fclose(store->data);
+    if (store->index)
+        fclose(store->index);
+    store->data = store->index = NULL;
+
+    if (!store->slots || width != store->width)
+    {
+        size_t chunk_bytes = (size_t)CHUNK_ROWS * width;
+        long count = chunk_budget_kb * 1024 / (long)chunk_bytes;
+        if (count < 2)
+            count = 2; // The chunk being written behind the map and the one being read back
+        free(store->slots);
+        store->slots = calloc(1, count * (sizeof(ChunkSlot) + chunk_bytes));
+        store->slot_count = store->slots ? (int)count : 0;
+        store->width = width;
+        if (!store->slots)
+            return false;
+        char *rows = (char *)(store->slots + count);
+        for (int i = 0; i < store->slot_count; i++)
+        {
+            store->slots[i].rows = rows + i * chunk_bytes;
+        }
+    }
+    for (int i = 0; i < store->slot_count; i++)
+    {
+        store->slots[i].id = -1;
+        store->slots[i].present = 0;
+        store->slots[i].dirty = false;
+        store->slots[i].stamp = 0;
+    }
+    store->clock = 0;
+    store->origin = *origin;
+    return true;
+}
+
+// The game's store, emptied first if it holds rows of another run or map width
+ChunkStore *run_history(Game *game) // Function definition
+{
+    ChunkStore *store = game->history;
+    if (store && (store->width != game->width || memcmp(&store->origin, &game->map_origin, sizeof(Rng)) != 0) &&
+        !reset_chunk_store(store, game->width, &game->map_origin))
+        return NULL;
+    return store;
+}
+
+// The resident slot for chunk id, read back from disk or evicting the least recently used
+// chunk as needed. Without create, NULL when the chunk was never written out.
+ChunkSlot *chunk_slot(ChunkStore *store, long id, bool create) // Function definition
+{
+    ChunkSlot *victim = NULL;
+    for (int i = 0; i < store->slot_count; i++)
+    {
+        ChunkSlot *slot = &store->slots[i];
+        if (slot->id == id)
+        {
+            slot->stamp = ++store->clock;
+            return slot;
+        }
+        if (!victim || slot->stamp < victim->stamp)
+            victim = slot;
+    }
+
+    profile_begin();
+    ChunkRecord record;
+    bool on_disk = read_chunk_record(store, id, &record);
+    if (!victim || (!on_disk && !create))
+    {
+        profile_end(PHASE_FILE_IO);
+        return NULL;
+    }
+    if (victim->id >= 0)
+    {
+        if (victim->dirty)
+            write_chunk(store, victim); // If this fails its rows are generated again when needed
+        store->evictions++;
+    }
+    victim->id = id;
+    victim->stamp = ++store->clock;
+    victim->dirty = false;
+    victim->present = 0;
+    if (on_disk && load_chunk(store, victim, &record))
+        store->loads++;
+    else
+        memset(victim->rows, 0, (size_t)CHUNK_ROWS * store->width);
+    profile_end(PHASE_FILE_IO);
+    return victim;
+}
+
+bool read_chunk_record(ChunkStore *store, long id, ChunkRecord *record) // Function definition
+{
+    return store->index && fseek(store->index, id * (long)sizeof(ChunkRecord), SEEK_SET) == 0 &&
+           fread(record, sizeof(ChunkRecord), 1, store->index) == 1 && record->length > 0;
+}
+
+// Record: presence mask, then (run length, tile) pairs over every row of the chunk. The
+// files are opened on the first eviction, so games that never evict never touch the disk.
+bool write_chunk(ChunkStore *store, ChunkSlot *slot) // Function definition
+{
+    if ((!store->data && !(store->data = tmpfile())) || (!store->index && !(store->index = tmpfile())))
+        return false;
+
+    ByteWriter *out = &store->record;
+    out->length = 0;
+    out->ok = true;
+    write_u64(out, slot->present);
+    size_t cells = (size_t)CHUNK_ROWS * store->width;
+    for (size_t i = 0; i < cells;)
+    {
+        size_t run = 1;
+        while (i + run < cells && run < 255 && slot->rows[i + run] == slot->rows[i])
+            run++;
+        write_u8(out, (uint8_t)run);
+        write_u8(out, (uint8_t)slot->rows[i]);
+        i += run;
+    }
+    if (!out->ok)
+        return false;
+
+    ChunkRecord record;
+    if (!read_chunk_record(store, slot->id, &record) || record.capacity < out->length)
+    {
+        if (fseek(store->data, 0, SEEK_END) != 0)
+            return false;
+        record.offset = (uint64_t)ftell(store->data);
+        record.capacity = (uint32_t)out->length;
+    }
+    record.length = (uint32_t)out->length;
+    if (fseek(store->data, (long)record.offset, SEEK_SET) != 0 ||
+        fwrite(out->data, 1, out->length, store->data) != out->length ||
+        fseek(store->index, slot->id * (long)sizeof(ChunkRecord), SEEK_SET) != 0 ||
+        fwrite(&record, sizeof(record), 1, store->index) != 1)
+        return false;
+    slot->dirty = false;
+    store->writes++;
+    store->bytes_written += out->length;
+    return true;
+}
+
+bool load_chunk(ChunkStore *store, ChunkSlot *slot, const ChunkRecord *record) // Function definition
+{
+    unsigned char *bytes = malloc(record->length);
+    bool ok = bytes && fseek(store->data, (long)record->offset, SEEK_SET) == 0 &&
+              fread(bytes, 1, record->length, store->data) == record->length;
+    ByteReader reader = {bytes, ok ? record->length : 0, 0, ok};
+    slot->present = read_u64(&reader);
+    size_t cells = (size_t)CHUNK_ROWS * store->width;
+    for (size_t i = 0; reader.ok && i < cells;)
+    {
+        int run = read_u8(&reader);
+        char tile = (char)read_u8(&reader);
+        if (run == 0 || i + run > cells)
+            reader.ok = false;
+        else
+            memset(slot->rows + i, tile, run);
+        i += run;
+    }
+    free(bytes);
+    if (!reader.ok)
+        slot->present = 0;
+    return reader.ok;
+}
+
+// Map stream draws taken before world_row was generated. The first map is generated top down
+// (world rows height - 1 .. 0), every later row in order as it first scrolls in.
+uint64_t row_stream_draws(Game *game, long world_row) // Function definition
+{
+    uint64_t position = world_row < game->height ? (uint64_t)(game->height - 1 - world_row) : (uint64_t)world_row;
+    return position * (2 * ((game->width + 3) / 4)); // generate_row_tiles() draws twice per 4 cells
+}
+
+void rebuild_world_row(Game *game, long world_row, char *row) // Function definition
+{
+    Rng rng = game->map_origin;
+    rng_advance(&rng, row_stream_draws(game, world_row));
+    long offset = world_row - game->height; // world_offset when the row scrolled in; negative for the first map
+    generate_row_tiles(row, game->width, &rng, offset >= 200 && offset % 200 == 0, false);
+}
+
+// Keeps a row leaving the map; rows never change, so one that is already stored stays as it is
+void store_history_row(Game *game, long world_row, const char *row) // Function definition
+{
+    ChunkStore *store = run_history(game);
+    ChunkSlot *slot = store ? chunk_slot(store, world_row / CHUNK_ROWS, true) : NULL;
+    uint64_t bit = 1ULL << (world_row % CHUNK_ROWS);
+    if (!slot || (slot->present & bit))
+        return;
+    memcpy(slot->rows + (size_t)(world_row % CHUNK_ROWS) * store->width, row, store->width);
+    slot->present |= bit;
+    slot->dirty = true;
+}
+
+// A row coming back onto the map, from the store when it holds it
+void fetch_history_row(Game *game, long world_row, char *row) // Function definition
+{
+    ChunkStore *store = run_history(game);
+    ChunkSlot *slot = store ? chunk_slot(store, world_row / CHUNK_ROWS, false) : NULL;
+    if (slot && (slot->present >> (world_row % CHUNK_ROWS) & 1))
+    {
+        memcpy(row, slot->rows + (size_t)(world_row % CHUNK_ROWS) * store->width, store->width);
+        return;
+    }
+    rebuild_world_row(game, world_row, row);
+    if (store)
+        store->rebuilds++;
+}
+
+// Reads the chunk of world_row while the map edge is still CHUNK_PREFETCH_ROWS away from it
+void prefetch_history(Game *game, long world_row) // Function definition
+{
+    ChunkStore *store = run_history(game);
+    if (!store || world_row < 0)
+        return;
+    unsigned long long loads = store->loads;
+    chunk_slot(store, world_row / CHUNK_ROWS, false);
+    if (store->loads > loads)
+        store->prefetches++;
+}
+
+void report_chunk_store(FILE *stream, const ChunkStore *store) // Function definition
+{
+    size_t resident = (size_t)store->slot_count * (sizeof(ChunkSlot) + (size_t)CHUNK_ROWS * store->width);
+    fprintf(stream, "history: %d chunk slots (%zu KB), loads=%llu (prefetched %llu) writes=%llu evictions=%llu\n",
+            store->slot_count, resident / 1024, store->loads, store->prefetches, store->writes, store->evictions);
+    fprintf(stream, "history: rebuilt rows=%llu, written %.1f KB\n", store->rebuilds, store->bytes_written / 1024.0);
+}
+
+// Enemy pool implementations
+bool reserve_enemies(EnemyPool *pool, int capacity) // Function definition
+{
+    if (capacity <= pool->capacity)
+        return true;
+
+    int new_capacity = pool->capacity ? pool->capacity : ENEMY_POOL_MIN_CAPACITY;
+    while (new_capacity < capacity)
+        new_capacity *= 2;
+
+    Enemy *items = realloc(pool->items, new_capacity * sizeof(Enemy));
+    if (!items)
+        return false;
+    pool->items = items;
+
+    int *slot_of = realloc(pool->slot_of, new_capacity * sizeof(int));
+    if (!slot_of)
+        return false;
+    pool->slot_of = slot_of;
+
+    // Never more slots than the peak live count, so the slot table shares the capacity
+    EnemySlot *slots = realloc(pool->slots, new_capacity * sizeof(EnemySlot));
+    if (!slots)
+        return false;
+    pool->slots = slots;
+
+    pool->capacity = new_capacity;
+    return true;
+}
+
+EnemyHandle add_enemy(EnemyPool *pool, Enemy enemy) // Function definition
+{
+    if (pool->count == pool->capacity && !reserve_enemies(pool, pool->count + 1))
+        return (EnemyHandle){-1, 0};
+
+    int slot = pool->free_slot;
+    if (slot >= 0)
+    {
+        pool->free_slot = pool->slots[slot].dense;
+    }
+    else
+    {
+        slot = pool->slot_count++;
+        pool->slots[slot].generation = 0;
+    }
+
+    int index = pool->count++;
+    pool->items[index] = enemy;
+    pool->slot_of[index] = slot;
+    pool->slots[slot].dense = index;
+    return (EnemyHandle){slot, pool->slots[slot].generation};
+}
+
+// Removes items[index] by moving the last enemy into its place
+void remove_enemy(EnemyPool *pool, int index) // Function definition
+{
+    int slot = pool->slot_of[index];
+    int last = --pool->count;
+    if (index != last)
+    {
+        pool->items[index] = pool->items[last];
+        pool->slot_of[index] = pool->slot_of[last];
+        pool->slots[pool->slot_of[index]].dense = index;
+    }
+
+    pool->slots[slot].generation++;
+    pool->slots[slot].dense = pool->free_slot;
+    pool->free_slot = slot;
+}
+
+EnemyHandle enemy_handle(const EnemyPool *pool, int index) // Function definition
+{
+    int slot = pool->slot_of[index];
+    return (EnemyHandle){slot, pool->slots[slot].generation};
+}
+
+// Resolves a handle, or NULL once the enemy it named has been removed
+Enemy *get_enemy(EnemyPool *pool, EnemyHandle handle) // Function definition
+{
+    if (handle.slot < 0 || handle.slot >= pool->slot_count ||
+        pool->slots[handle.slot].generation != handle.generation)
+        return NULL;
+    return &pool->items[pool->slots[handle.slot].dense];
+}
+
+void clear_enemies(EnemyPool *pool) // Function definition
+{
+    // Retire every live handle, then rebuild the free list from scratch
+    for (int i = 0; i < pool->count; i++)
+    {
+        pool->slots[pool->slot_of[i]].generation++;
+    }
+    pool->count = 0;
+    pool->free_slot = -1;
+    for (int slot = pool->slot_count - 1; slot >= 0; slot--)
+    {
+        pool->slots[slot].dense = pool->free_slot;
+        pool->free_slot = slot;
+    }
+}
+
+void free_enemy_pool(EnemyPool *pool) // Function definition
+{
+    free(pool->items);
+    free(pool->slot_of);
+    free(pool->slots);
+    *pool = (EnemyPool){.free_slot = -1};
+}
+
+// Occupancy grid implementations
+// Enemies are linked per cell through their pool slots. Grid rows are physical ring rows,
+// so scrolling the world moves every enemy down without relinking anything.
+void link_enemy(Game *game, int slot, int x, int y) // Function definition
+{
+    if (x < 0 || x >= game->width || y < 0 || y >= game->height)
+        return;
+    size_t row = map_row_index(game, y);
+    int *head = &game->grid.occupancy[row * game->width + x];
+    game->enemies.slots[slot].next_in_cell = *head;
+    *head = slot;
+    game->grid.occupied[row * game->row_words + x / 64] |= 1ULL << (x % 64);
+}
+
+void unlink_enemy(Game *game, int slot, int x, int y) // Function definition
+{
+    if (x < 0 || x >= game->width || y < 0 || y >= game->height)
+        return;
+    size_t row = map_row_index(game, y);
+    int *cell = &game->grid.occupancy[row * game->width + x];
+    int *link = cell;
+    while (*link >= 0 && *link != slot)
+    {
+        link = &game->enemies.slots[*link].next_in_cell;
+    }
+    if (*link == slot)
+        *link = game->enemies.slots[slot].next_in_cell;
+    if (*cell < 0)
+        game->grid.occupied[row * game->row_words + x / 64] &= ~(1ULL << (x % 64));
+}
+
+void reset_enemies(Game *game) // Function definition
+{
+    clear_enemies(&game->enemies);
+    memset(game->grid.occupancy, 0xff, (size_t)game->width * game->height * sizeof(int)); // All -1
+    memset(game->grid.occupied, 0, (size_t)game->row_words * game->height * sizeof(uint64_t));
+    game->boss_count = 0;
+}
+
+EnemyHandle place_enemy(Game *game, Enemy enemy) // Function definition
+{
+    EnemyHandle handle = add_enemy(&game->enemies, enemy);
+    if (handle.slot < 0)
+        return handle;
+    link_enemy(game, handle.slot, enemy.x, enemy.y);
+    if (enemy.is_boss)
+        game->boss_count++;
+    return handle;
+}
+
+void despawn_enemy(Game *game, int index) // Function definition
+{
+    Enemy *enemy = &game->enemies.items[index];
+    unlink_enemy(game, game->enemies.slot_of[index], enemy->x, enemy->y);
+    if (enemy->is_boss)
+        game->boss_count--;
+    remove_enemy(&game->enemies, index);
+}
+
+void move_enemy(Game *game, int index, int x, int y) // Function definition
+{
+    Enemy *enemy = &game->enemies.items[index];
+    int slot = game->enemies.slot_of[index];
+    unlink_enemy(game, slot, enemy->x, enemy->y);
+    enemy->x = x;
+    enemy->y = y;
+    link_enemy(game, slot, x, y);
+}
+
+// Index into enemy_pool.items of an enemy standing on (x, y), or -1
+int enemy_at(Game *game, int x, int y) // Function definition
+{
+    if (x < 0 || x >= game->width || y < 0 || y >= game->height)
+        return -1;
+    int slot = game->grid.occupancy[(size_t)map_row_index(game, y) * game->width + x];
+    return slot >= 0 ? game->enemies.slots[slot].dense : -1;
+}
+
+// Collects up to max enemy indices within a square of the given radius
+int find_enemies_near(Game *game, int x, int y, int radius, int *found, int max) // Function definition
+{
+    int count = 0;
+    int min_x = x - radius < 0 ? 0 : x - radius;
+    int max_x = x + radius >= game->width ? game->width - 1 : x + radius;
+    int min_y = y - radius < 0 ? 0 : y - radius;
+    int max_y = y + radius >= game->height ? game->height - 1 : y + radius;
+
+    for (int cy = min_y; cy <= max_y && count < max; cy++)
+    {
+        const int *row = game->grid.occupancy + (size_t)map_row_index(game, cy) * game->width;
+        for (int cx = min_x; cx <= max_x && count < max; cx++)
+        {
+            for (int slot = row[cx]; slot >= 0 && count < max; slot = game->enemies.slots[slot].next_in_cell)
+            {
+                found[count++] = game->enemies.slots[slot].dense;
+            }
+        }
+    }
+    return count;
+}
+
+// Game logic implementations
+void update_score(Game *game) // Function definition
+{
+    game->player.score = game->furthest_offset;
+}
+
+void shift_world_down(Game *game) // Function definition
+{
+    profile_begin();
+    bool fresh = game->world_offset == game->furthest_offset; // The new top row was never on the map
+    bool is_boss_room = fresh && (game->world_offset >= 200) && (game->world_offset % 200 == 0);
+
+    if (is_boss_room)
+    {
+        int boss_x = game->width / 2;
+        int boss_y = game->height / 2;
+
+        Enemy boss = {
+            boss_x, boss_y,
+            game->balance.boss_hp + (game->world_offset / game->balance.boss_hp_rate),
+            game->balance.boss_strength + (game->world_offset / game->balance.boss_strength_rate),
+            game->balance.boss_xp + (game->world_offset / game->balance.boss_xp_rate),
+            true};
+        place_enemy(game, boss);
+
+        // Keep the warning up for a second and at least 2 moves, without holding up play
+        if (!game->headless)
+        {
+            post_message(game, MSG_LINE_1, COLOR_BRIGHT_RED, "!!! BOSS AHEAD !!!", 1.0, 2);
+            post_message(game, MSG_LINE_2, COLOR_BRIGHT_RED, "Defeat it to progress!", 1.0, 2);
+        }
+    }
+
+    // Enemies on the bottom row scroll off the map; their row is reused as the new top
+    for (int i = 0; i < game->enemies.count; i++)
+    {
+        if (game->enemies.items[i].y >= game->height - 1)
+        {
+            despawn_enemy(game, i);
+            i--; // The last enemy was swapped into slot i, visit it too
+        }
+    }
+
+    // Scroll by moving the head back one row; the old bottom row goes to the history store and
+    // its slot becomes the new top
+    store_history_row(game, game->world_offset, map_row(game, game->height - 1));
+    game->map_head = (game->map_head == 0) ? game->height - 1 : game->map_head - 1;
+    if (fresh)
+    {
+        scroll_in_row(game);
+        game->furthest_offset++;
+    }
+    else
+    {
+        fetch_history_row(game, game->world_offset + game->height, map_row(game, 0));
+        update_walkable_row(game, 0);
+        if (game->world_offset + 1 < game->furthest_offset)
+            prefetch_history(game, game->world_offset + game->height + CHUNK_PREFETCH_ROWS);
+    }
+    game->world_offset++;
+    update_score(game);
+
+    // Occupancy rows are physical, so the grid already matches the shifted positions
+    game->player.y++;
+    for (int i = 0; i < game->enemies.count; i++)
+    {
+        game->enemies.items[i].y++;
+    }
+    profile_end(PHASE_SHIFT);
+}
+
+// Walks back over rows that scrolled off: the top row goes to the history store and the row
+// below the map comes back from it
+void shift_world_up(Game *game) // Function definition
+{
+    profile_begin();
+    for (int i = 0; i < game->enemies.count; i++)
+    {
+        if (game->enemies.items[i].y <= 0)
+        {
+            despawn_enemy(game, i);
+            i--; // The last enemy was swapped into slot i, visit it too
+        }
+    }
+
+    store_history_row(game, game->world_offset + game->height - 1, map_row(game, 0));
+    game->map_head = (game->map_head == game->height - 1) ? 0 : game->map_head + 1;
+    game->world_offset--;
+    fetch_history_row(game, game->world_offset, map_row(game, game->height - 1));
+    update_walkable_row(game, game->height - 1);
+    prefetch_history(game, game->world_offset - CHUNK_PREFETCH_ROWS);
+
+    game->player.y--;
+    for (int i = 0; i < game->enemies.count; i++)
+    {
+        game->enemies.items[i].y--;
+    }
+    profile_end(PHASE_SHIFT);
+}
+
+// Spawn candidates are kept as counts rather than a list, so a wave costs one popcount pass
+// over the row masks however large the map is. A cell is eligible when it is walkable, free of
+// enemies, and at least 5 columns and 5 rows away from the player.
+uint64_t spawn_cell_bits(Game *game, int y, int word) // Function definition
+{
+    if (y < 1 || y >= game->height - 1 || abs(y - game->player.y) < 5)
+        return 0;
+    size_t at = (size_t)map_row_index(game, y) * game->row_words + word;
+    return game->grid.walkable[at] & ~game->grid.occupied[at] &
+           ~column_span(game->player.x - 4, game->player.x + 4, word);
+}
+
+// Fills grid.spawn_counts with the eligible cells of every row and returns the total
+int count_spawn_cells(Game *game) // Function definition
+{
+    int total = 0;
+    for (int y = 0; y < game->height; y++)
+    {
+        int count = 0;
+        for (int w = 0; w < game->row_words; w++)
+        {
+            count += __builtin_popcountll(spawn_cell_bits(game, y, w));
+        }
+        game->grid.spawn_counts[y] = count;
+        total += count;
+    }
+    return total;
+}
+
+// The pick-th eligible cell in row-major order (pick < the count_spawn_cells() total). The
+// chosen row's count drops by one; placing an enemy there takes the cell out of the masks.
+bool take_spawn_cell(Game *game, int pick, int *x, int *y) // Function definition
+{
+    int row = 0;
+    while (row < game->height && pick >= game->grid.spawn_counts[row])
+    {
+        pick -= game->grid.spawn_counts[row++];
+    }
+    if (row == game->height)
+        return false;
+
+    for (int w = 0; w < game->row_words; w++)
+    {
+        uint64_t bits = spawn_cell_bits(game, row, w);
+        int count = __builtin_popcountll(bits);
+        if (pick >= count)
+        {
+            pick -= count;
+            continue;
+        }
+        while (pick-- > 0)
+            bits &= bits - 1;
+        *x = w * 64 + __builtin_ctzll(bits);
+        *y = row;
+        game->grid.spawn_counts[row]--;
+        return true;
+    }
+    return false;
+}
+
+// Places a wave of enemies on distinct eligible cells, each drawn uniformly with one roll.
+// Returns how many were placed; fewer than rolled means the map ran out of eligible cells.
+int spawn_enemies(Game *game) // Function definition
+{
+    if (game->boss_count > 0 || game->enemies.count >= game->max_enemies)
+        return 0;
+    profile_begin();
+
+    float progress_factor = 1 + (game->world_offset / game->balance.progress_rate);
+    int enemies_to_spawn = 3 + rng_range(&game->rng.spawn, 3);
+
+    int candidates = count_spawn_cells(game);
+    int placed = 0;
+
+    for (; placed < enemies_to_spawn && game->enemies.count < game->max_enemies && candidates > 0; placed++)
+    {
+        int x, y;
+        if (!take_spawn_cell(game, rng_range(&game->rng.spawn, candidates), &x, &y))
+            break;
+        candidates--;
+
+        Enemy enemy = {
+            x, y,
+            (int)(10 * progress_factor),
+            (int)(4 * progress_factor),
+            (int)(5 * progress_factor),
+            false};
+        place_enemy(game, enemy);
+    }
+    profile_end(PHASE_SPAWN);
+    return placed;
+}
+
+void move_enemies(Game *game) // Function definition
+{
+    profile_begin();
+    for (int i = 0; i < game->enemies.count; i++)
+    {
+        Enemy *enemy = &game->enemies.items[i];
+        int dx = game->player.x - enemy->x;
+        int dy = game->player.y - enemy->y;
+        int step_x = 0, step_y = 0;
+
+        if (abs(dx) <= 5 && abs(dy) <= 5)
+        {
+            // Chasers walk the shared flow field, so they route around '[]' and '~';
+            // past its reach they fall back to a straight step
+            if (game->flow_stale)
+                update_flow_field(game);
+            if (!flow_step(game, enemy, abs(dx) > abs(dy), &step_x, &step_y))
+            {
+                if (abs(dx) > abs(dy))
+                {
+                    if (dx > 0 && is_walkable(game, enemy->x + 1, enemy->y))
+                        step_x = 1;
+                    else if (dx < 0 && is_walkable(game, enemy->x - 1, enemy->y)) // Function definition
+                        step_x = -1;
+                }
+                else
+                {
+                    if (dy > 0 && is_walkable(game, enemy->x, enemy->y + 1))
+                        step_y = 1;
+                    else if (dy < 0 && is_walkable(game, enemy->x, enemy->y - 1)) // Function definition
+                        step_y = -1;
+                }
+            }
+        }
+        else
+        {
+            int dir = rng_range(&game->rng.ai, 4);
+            switch (dir)
+            {
+            case 0:
+                if (is_walkable(game, enemy->x, enemy->y - 1))
+                    step_y = -1;// move down
+                break;
+            case 1:
+                if (is_walkable(game, enemy->x, enemy->y + 1))
+                    step_y = 1;// move up
+                break;
+            case 2:
+                if (is_walkable(game, enemy->x - 1, enemy->y))
+                    step_x = -1;// move left
+                break;
+            case 3:
+                if (is_walkable(game, enemy->x + 1, enemy->y))
+                    step_x = 1;// move right
+                break;
+            }
+        }
+
+        if (step_x != 0 || step_y != 0)
+            move_enemy(game, i, enemy->x + step_x, enemy->y + step_y);
+    }
+    profile_end(PHASE_ENEMIES);
+}
+
+void check_collisions(Game *game) // Function definition
+{
+    profile_begin();
+    int i = enemy_at(game, game->player.x, game->player.y);
+    if (i < 0)
+    {
+        profile_end(PHASE_COLLISIONS);
+        return;
+    }
+
+    Enemy *enemy = &game->enemies.items[i];
+
+    // Player attacks enemy
+    enemy->hp -= game->player.strength;
+
+    if (enemy->hp <= 0)
+    {
+        game->player.xp += enemy->xp_value;
+
+        if (enemy->is_boss)
+        {
+            game->player.strength += 5;
+            if (!game->headless)
+            {
+                clear_messages();
+                post_message(game, MSG_LINE_1, COLOR_BRIGHT_RED, ">>> VICTORY! Boss defeated! <<<", 3.5, 0);
+                post_message(game, MSG_LINE_2, COLOR_BRIGHT_RED, ">>> You feel stronger! <<<", 3.5, 0);
+            }
+        }
+
+        // Remove defeated enemy
+        despawn_enemy(game, i);
+
+        // Check for level up
+        if (game->player.xp >= game->player.xp_to_level)
+        {
+            game->player.level++;
+            game->player.xp -= game->player.xp_to_level;
+            game->player.xp_to_level = (int)(game->player.xp_to_level * game->balance.xp_growth);
+            game->player.max_hp += 5;
+            game->player.hp = game->player.max_hp;
+            game->player.strength += 2;
+        }
+    }
+    else
+    {
+        // Enemy attacks player; play_turn() decides whether it was fatal once the turn is over
+        game->player.hp -= enemy->strength;
+        game->hit_by_boss = enemy->is_boss;
+        if (game->player.hp <= 0)
+            game->player.hp = 0; // Prevent negative HP
+    }
+    profile_end(PHASE_COLLISIONS);
+}
+
+// Pathfinding implementations
+// Breadth-first search from the player over the walkable masks, shared by every chasing enemy.
+// Each step spreads the whole frontier one cell in all four directions with shifts and ORs,
+// so a layer costs a few word operations per row. It runs at most once per player move, and
+// its cost does not depend on how many enemies are chasing. Nothing farther than
+// FLOW_MAX_STEPS is searched, so only a window around the player is touched, however big the map.
+void update_flow_field(Game *game) // Function definition
+{
+    int row_words = game->row_words;
+    uint64_t *reached = game->grid.flow_reached;
+
+    // Forget the previous search; it never set anything outside its window
+    for (int y = game->flow_rows[0]; y <= game->flow_rows[1]; y++)
+    {
+        memset(reached + (size_t)y * row_words + game->flow_words[0], 0,
+               (game->flow_words[1] - game->flow_words[0] + 1) * sizeof(uint64_t));
+    }
+    game->flow_rows[0] = game->flow_rows[1] = 0;
+    game->flow_words[0] = game->flow_words[1] = 0;
+    game->flow_stale = false;
+    int px = game->player.x, py = game->player.y;
+    if (px < 0 || px >= game->width || py < 0 || py >= game->height)
+        return;
+
+    int first_y = py - FLOW_MAX_STEPS < 0 ? 0 : py - FLOW_MAX_STEPS;
+    int last_y = py + FLOW_MAX_STEPS >= game->height ? game->height - 1 : py + FLOW_MAX_STEPS;
+    int first_w = (px - FLOW_MAX_STEPS < 0 ? 0 : px - FLOW_MAX_STEPS) / 64;
+    int last_w = (px + FLOW_MAX_STEPS >= game->width ? game->width - 1 : px + FLOW_MAX_STEPS) / 64;
+    game->flow_rows[0] = first_y;
+    game->flow_rows[1] = last_y;
+    game->flow_words[0] = first_w;
+    game->flow_words[1] = last_w;
+
+    uint64_t *layers[2] = {game->grid.flow_layers, game->grid.flow_layers + (size_t)game->height * row_words};
+    for (int y = first_y; y <= last_y; y++)
+    {
+        for (int i = 0; i < 2; i++)
+            memset(layers[i] + (size_t)y * row_words + first_w, 0, (last_w - first_w + 1) * sizeof(uint64_t));
+    }
+
+    size_t start = (size_t)py * row_words + px / 64;
+    game->grid.flow[(size_t)py * game->width + px] = 0;
+    reached[start] = 1ULL << (px % 64);
+    layers[0][start] = reached[start];
+
+    for (int step = 1; step <= FLOW_MAX_STEPS; step++)
+    {
+        const uint64_t *frontier = layers[(step - 1) & 1];
+        uint64_t *fresh = layers[step & 1];
+        bool grew = false;
+        int low_y = py - step < first_y ? first_y : py - step; // Rows the search can have reached by now
+        int high_y = py + step > last_y ? last_y : py + step;
+        for (int y = low_y; y <= high_y; y++)
+        {
+            const uint64_t *walkable = game->grid.walkable + (size_t)map_row_index(game, y) * row_words;
+            const uint64_t *row = frontier + (size_t)y * row_words;
+            for (int w = first_w; w <= last_w; w++)
+            {
+                uint64_t spread = row[w] << 1 | row[w] >> 1;
+                if (w > first_w)
+                    spread |= row[w - 1] >> 63;
+                if (w < last_w)
+                    spread |= row[w + 1] << 63;
+                if (y > first_y)
+                    spread |= row[w - row_words];
+                if (y < last_y)
+                    spread |= row[w + row_words];
+
+                size_t at = (size_t)y * row_words + w;
+                uint64_t cells = spread & walkable[w] & ~reached[at];
+                fresh[at] = cells;
+                reached[at] |= cells;
+                grew |= cells != 0;
+                while (cells)
+                {
+                    game->grid.flow[(size_t)y * game->width + w * 64 + __builtin_ctzll(cells)] = (uint8_t)step;
+                    cells &= cells - 1;
+                }
+            }
+        }
+        if (!grew)
+            break;
+    }
+}
+
+// Step that takes the enemy one cell closer to the player along the flow field. When both axes
+// get closer, prefer_x picks the horizontal step (the axis the enemy is farther off on).
+// Returns false when the field has no path from the enemy or it already stands on the player.
+bool flow_step(Game *game, const Enemy *enemy, bool prefer_x, int *step_x, int *step_y) // Function definition
+{
+    static const int axis_steps[2][2][2] = {{{0, 1}, {0, -1}}, {{1, 0}, {-1, 0}}}; // [horizontal][option][dx, dy]
+    const uint64_t *reached = game->grid.flow_reached;
+    const uint8_t *flow = game->grid.flow;
+    int row_words = game->row_words;
+    if (!((reached[(size_t)enemy->y * row_words + enemy->x / 64] >> (enemy->x % 64)) & 1))
+        return false;
+    int here = flow[(size_t)enemy->y * game->width + enemy->x];
+
+    for (int pass = 0; pass < 2; pass++)
+    {
+        bool horizontal = (pass == 0) == prefer_x;
+        for (int option = 0; option < 2; option++)
+        {
+            int x = enemy->x + axis_steps[horizontal][option][0];
+            int y = enemy->y + axis_steps[horizontal][option][1];
+            if (x < 0 || x >= game->width || y < 0 || y >= game->height)
+                continue;
+            if (((reached[(size_t)y * row_words + x / 64] >> (x % 64)) & 1) && flow[(size_t)y * game->width + x] < here)
+            {
+                *step_x = axis_steps[horizontal][option][0];
+                *step_y = axis_steps[horizontal][option][1];
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+// Display implementations
+// Modified draw_game() function with better player stats display
+// Composes the frame into the back buffer; present_frame() sends only what changed
+// Only the cells inside the viewport are read: tiles row by row, enemies through the occupied masks
+void draw_game(Game *game) // Function definition
+{
+    profile_begin();
+    update_viewport(game);
+    clear_back_buffer();
+    bool is_boss_room = (game->world_offset >= 200) && (game->world_offset % 200 == 0);
+
+    // Draw map
+    for (int y = 0; y < view.height; y++)
+    {
+        const char *row = map_row(game, view.y + y) + view.x;
+        for (int x = 0; x < view.width; x++)
+        {
+            int map_x = view.x + x;
+            CellColor color = COLOR_DEFAULT;
+            if (row[x] == '~')
+            {
+                color = COLOR_CYAN;
+            }
+            else if (is_boss_room && map_x >= game->width / 2 - 5 && map_x <= game->width / 2 + 5)
+            {
+                color = COLOR_BOSS_ROOM;
+            }
+            put_cell(x, y, row[x], color);
+        }
+    }
+
+    // Draw player
+    put_cell(game->player.x - view.x, game->player.y - view.y, '@', COLOR_BRIGHT_WHITE);
+
+    // Draw enemies; a cell holding a boss shows the boss
+    for (int y = 0; y < view.height; y++)
+    {
+        size_t row = map_row_index(game, view.y + y);
+        const uint64_t *occupied = game->grid.occupied + row * game->row_words;
+        const int *cells = game->grid.occupancy + row * game->width;
+        for (int w = view.x / 64; w <= (view.x + view.width - 1) / 64; w++)
+        {
+            uint64_t bits = occupied[w] & column_span(view.x, view.x + view.width - 1, w);
+            while (bits)
+            {
+                int x = w * 64 + __builtin_ctzll(bits);
+                bits &= bits - 1;
+                bool boss = false;
+                for (int slot = cells[x]; slot >= 0; slot = game->enemies.slots[slot].next_in_cell)
+                {
+                    boss |= game->enemies.items[game->enemies.slots[slot].dense].is_boss;
+                }
+                if (boss)
+                {
+                    put_cell(x - view.x, y, 'B', COLOR_BRIGHT_YELLOW);
+                }
+                else
+                {
+                    put_cell(x - view.x, y, 'e', COLOR_LIGHT_RED);
+                }
+            }
+        }
+    }
+
+    // Enhanced player stats display
+    put_text(0, view.height, COLOR_BRIGHT_CYAN, "Player: %s", game->player.name);
+
+    put_text(0, view.height + 1, COLOR_BRIGHT_YELLOW,
+             "HP: %d/%d | STR: %d | LVL: %d | XP: %d/%d | Score: %d",
+             game->player.hp, game->player.max_hp, game->player.strength, game->player.level,
+             game->player.xp, game->player.xp_to_level, game->player.score);
+
+    put_text(0, view.height + 2, COLOR_BRIGHT_WHITE, "Controls: WASD to move, P to save, Q to quit");
+
+    // Nearby enemies display
+    int stat_line = view.height + 3;
+    put_text(0, stat_line, COLOR_BRIGHT_RED, "Nearby enemies: ");
+
+    int nearby[2];
+    int visible_count = find_enemies_near(game, game->player.x, game->player.y, 3, nearby, 2);
+    for (int i = 0; i < visible_count; i++)
+    {
+        const Enemy *enemy = &game->enemies.items[nearby[i]];
+        int line = stat_line + 1 + i;
+        int x = 0;
+        if (enemy->is_boss)
+            x = put_text(x, line, COLOR_BRIGHT_YELLOW, "BOSS");
+        else
+            x = put_text(x, line, COLOR_LIGHT_RED, "Enemy");
+        x = put_text(x, line, COLOR_BRIGHT_RED, " HP:");
+        x = put_text(x, line, COLOR_DEFAULT, "%-3d ", enemy->hp);
+        x = put_text(x, line, COLOR_BRIGHT_RED, "STR:");
+        put_text(x, line, COLOR_DEFAULT, "%-2d", enemy->strength);
+    }
+
+    if (visible_count == 0)
+    {
+        put_text(16, stat_line, COLOR_GRAY, "None");
+    }
+
+    draw_messages(game);
+    present_frame();
+    publish_spectator_frame();
+    profile_end(PHASE_DRAW);
+}
+
+void show_welcome_screen() // Function definition
+{
+    clear_screen();
+    move_cursor(view.width / 2 - 10, view.height / 2 - 2);
+    output_printf("\033[1;35mWelcome to RougeByte!\033[0m");
+    move_cursor(view.width / 2 - 10, view.height / 2 - 1);
+    output_printf("\033[0;36mBeat your best steps!\033[0m");
+    end_frame();
+    wait_for_key(3000); // Any key skips it
+}
+
+int show_main_menu(bool has_save) // Function definition
+{
+    clear_screen();
+    int selected = 0;
+    int option_count = has_save ? 4 : 3; // 4 options if save exists, 3 otherwise
+    char options[4][20] = {
+        "Continue",
+        "New Game",
+        "Leaderboard",
+        "Exit"};
+
+    while (1)
+    {
+        clear_screen();
+        move_cursor(view.width / 2 - 8, view.height / 2 - 3);
+        output_printf("\033[1;34mMAIN MENU\033[0m");
+
+        // Only show Continue if save exists
+        int start_index = has_save ? 0 : 1;
+
+        for (int i = 0; i < option_count; i++)
+        {
+            move_cursor(view.width / 2 - 8, view.height / 2 - 1 + i);
+            if (i == selected)
+            {
+                output_printf("\033[1;32m> %s\033[0m", options[start_index + i]);
+            }
+            else
+            {
+                output_printf("  %s", options[start_index + i]);
+            }
+        }
+
+        end_frame();
+        char ch = get_key();
+        if (ch == 'w' || ch == 'W')
+        {
+            selected = (selected - 1 + option_count) % option_count;
+        }
+        else if (ch == 's' || ch == 'S') 
+        {
+            selected = (selected + 1) % option_count;
+        }
+        else if (ch == '\r' || ch == '\n') 
+        {
+            return has_save ? selected : selected + 1; // Adjust return value
+        }
+    }
+}
+// Leaderboard store implementations
+// FNV-1a
+uint32_t hash_name(const char *name) // Function definition
+{
+    uint32_t hash = 2166136261u;
+    for (; *name; name++)
+    {
+        hash = (hash ^ (unsigned char)*name) * 16777619u;
+    }
+    return hash;
+}
+
+// Rank order: farther first, then higher level, then name so every entry has its own place
+bool ranks_before(const LeaderboardEntry *a, const LeaderboardEntry *b) // Function definition
+{
+    if (a->distance != b->distance)
+        return a->distance > b->distance;
+    if (a->level != b->level)
+        return a->level > b->level;
+    return strcmp(a->name, b->name) < 0;
+}
+
+bool reserve_leaderboard(Leaderboard *board, int capacity) // Function definition
+{
+    if (capacity < 0 || capacity > LEADERBOARD_MAX_ENTRIES)
+        return false;
+    if (capacity > board->capacity)
+    {
+        int new_capacity = board->capacity ? board->capacity : 64;
+        while (new_capacity < capacity)
+            new_capacity *= 2;
+
+        LeaderboardEntry *entries = realloc(board->entries, new_capacity * sizeof(LeaderboardEntry));
+        if (!entries)
+            return false;
+        board->entries = entries;
+        LeaderboardNode *nodes = realloc(board->nodes, new_capacity * sizeof(LeaderboardNode));
+        if (!nodes)
+            return false;
+        board->nodes = nodes;
+        board->capacity = new_capacity;
+    }
+
+    // Keep the name table at most half full; rebuilding it only needs the entries
+    if (capacity * 2 > board->name_capacity)
+    {
+        int name_capacity = board->name_capacity ? board->name_capacity : 128;
+        while (name_capacity < capacity * 2)
+            name_capacity *= 2;
+        int *by_name = malloc(name_capacity * sizeof(int));
+        if (!by_name)
+            return false;
+        memset(by_name, 0xff, name_capacity * sizeof(int)); // All -1
+        for (int i = 0; i < board->count; i++)
+        {
+            uint32_t h = hash_name(board->entries[i].name) & (name_capacity - 1);
+            while (by_name[h] >= 0)
+                h = (h + 1) & (name_capacity - 1);
+            by_name[h] = i;
+        }
+        free(board->by_name);
+        board->by_name = by_name;
+        board->name_capacity = name_capacity;
+    }
+    return true;
+}
+
+// Entry index for a player name, or -1
+int find_leaderboard_entry(const Leaderboard *board, const char *name) // Function definition
+{
+    if (board->name_capacity == 0)
+        return -1;
+    uint32_t mask = board->name_capacity - 1;
+    for (uint32_t h = hash_name(name) & mask; board->by_name[h] >= 0; h = (h + 1) & mask)
+    {
+        if (strcmp(board->entries[board->by_name[h]].name, name) == 0)
+            return board->by_name[h];
+    }
+    return -1;
+}
+
+// Adds an entry to the name index only; the caller places it in the rank treap
+int append_leaderboard_entry(Leaderboard *board, const LeaderboardEntry *entry) // Function definition
+{
+    if (!reserve_leaderboard(board, board->count + 1))
+        return -1;
+    int index = board->count++;
+    board->entries[index] = *entry;
+    board->nodes[index] = (LeaderboardNode){-1, -1, 1, rng_next(&board->priorities)};
+
+    uint32_t mask = board->name_capacity - 1;
+    uint32_t h = hash_name(entry->name) & mask;
+    while (board->by_name[h] >= 0)
+        h = (h + 1) & mask;
+    board->by_name[h] = index;
+    return index;
+}
+
+void update_rank_size(Leaderboard *board, int node) // Function definition
+{
+    LeaderboardNode *n = &board->nodes[node];
+    n->size = 1 + (n->left >= 0 ? board->nodes[n->left].size : 0) +
+              (n->right >= 0 ? board->nodes[n->right].size : 0);
+}
+
+// Treap insert; rotations keep the higher priority on top. Returns the new subtree root.
+int insert_rank(Leaderboard *board, int root, int index) // Function definition
+{
+    if (root < 0)
+        return index;
+    LeaderboardNode *nodes = board->nodes;
+    if (ranks_before(&board->entries[index], &board->entries[root]))
+    {
+        nodes[root].left = insert_rank(board, nodes[root].left, index);
+        int child = nodes[root].left;
+        if (nodes[child].priority > nodes[root].priority)
+        {
+            nodes[root].left = nodes[child].right;
+            nodes[child].right = root;
+            update_rank_size(board, root);
+            update_rank_size(board, child);
+            return child;
+        }
+    }
+    else
+    {
+        nodes[root].right = insert_rank(board, nodes[root].right, index);
+        int child = nodes[root].right;
+        if (nodes[child].priority > nodes[root].priority)
+        {
+            nodes[root].right = nodes[child].left;
+            nodes[child].left = root;
+            update_rank_size(board, root);
+            update_rank_size(board, child);
+            return child;
+        }
+    }
+    update_rank_size(board, root);
+    return root;
+}
+
+// Joins two treaps where every entry of a ranks before every entry of b
+int merge_ranks(Leaderboard *board, int a, int b) // Function definition
+{
+    if (a < 0)
+        return b;
+    if (b < 0)
+        return a;
+    if (board->nodes[a].priority > board->nodes[b].priority)
+    {
+        board->nodes[a].right = merge_ranks(board, board->nodes[a].right, b);
+        update_rank_size(board, a);
+        return a;
+    }
+    board->nodes[b].left = merge_ranks(board, a, board->nodes[b].left);
+    update_rank_size(board, b);
+    return b;
+}
+
+// Unlinks index from the treap; its entry must still hold the values it was inserted with
+int remove_rank(Leaderboard *board, int root, int index) // Function definition
+{
+    if (root < 0)
+        return -1;
+    LeaderboardNode *node = &board->nodes[root];
+    if (root == index)
+    {
+        int merged = merge_ranks(board, node->left, node->right);
+        *node = (LeaderboardNode){-1, -1, 1, node->priority};
+        return merged;
+    }
+    if (ranks_before(&board->entries[index], &board->entries[root]))
+        node->left = remove_rank(board, node->left, index);
+    else
+        node->right = remove_rank(board, node->right, index);
+    update_rank_size(board, root);
+    return root;
+}
+
+int compute_rank_sizes(Leaderboard *board, int node) // Function definition
+{
+    if (node < 0)
+        return 0;
+    LeaderboardNode *n = &board->nodes[node];
+    n->size = 1 + compute_rank_sizes(board, n->left) + compute_rank_sizes(board, n->right);
+    return n->size;
+}
+
+// Builds the treap in O(n) when the entries are already in rank order (as the file stores
+// them), inserting one by one otherwise. Returns the root.
+int build_ranks(Leaderboard *board) // Function definition
+{
+    bool sorted = true;
+    for (int i = 1; i < board->count && sorted; i++)
+    {
+        sorted = ranks_before(&board->entries[i - 1], &board->entries[i]);
+    }
+
+    if (!sorted)
+    {
+        int root = -1;
+        for (int i = 0; i < board->count; i++)
+        {
+            board->nodes[i] = (LeaderboardNode){-1, -1, 1, board->nodes[i].priority};
+            root = insert_rank(board, root, i);
+        }
+        return root;
+    }
+
+    // Cartesian tree over the sorted order: the stack holds the right spine
+    int *stack = malloc((board->count + 1) * sizeof(int));
+    if (!stack)
+        return -1;
+    int depth = 0;
+    for (int i = 0; i < board->count; i++)
+    {
+        LeaderboardNode *node = &board->nodes[i];
+        node->left = node->right = -1;
+        int last = -1;
+        while (depth > 0 && board->nodes[stack[depth - 1]].priority < node->priority)
+        {
+            last = stack[--depth];
+        }
+        node->left = last;
+        if (depth > 0)
+            board->nodes[stack[depth - 1]].right = i;
+        stack[depth++] = i;
+    }
+    int root = depth > 0 ? stack[0] : -1;
+    free(stack);
+    compute_rank_sizes(board, root);
+    return root;
+}
+
+// 1-based rank of an entry
+int leaderboard_rank(const Leaderboard *board, int index) // Function definition
+{
+    int rank = 1;
+    int node = board->root;
+    while (node >= 0)
+    {
+        const LeaderboardNode *n = &board->nodes[node];
+        int left_size = n->left >= 0 ? board->nodes[n->left].size : 0;
+        if (node == index)
+            return rank + left_size;
+        if (ranks_before(&board->entries[index], &board->entries[node]))
+        {
+            node = n->left;
+        }
+        else
+        {
+            rank += left_size + 1;
+            node = n->right;
+        }
+    }
+    return 0;
+}
+
+// Entry index at a 1-based rank, or -1
+int leaderboard_at(const Leaderboard *board, int rank) // Function definition
+{
+    int node = board->root;
+    while (node >= 0)
+    {
+        const LeaderboardNode *n = &board->nodes[node];
+        int left_size = n->left >= 0 ? board->nodes[n->left].size : 0;
+        if (rank <= left_size)
+        {
+            node = n->left;
+        }
+        else if (rank == left_size + 1)
+        {
+            return node;
+        }
+        else
+        {
+            rank -= left_size + 1;
+            node = n->right;
+        }
+    }
+    return -1;
+}
+
+// Records a run, keeping only each player's best distance. Returns true when the board changed.
+bool upsert_leaderboard(Leaderboard *board, const char *name, int level, int distance) // Function definition
+{
+    if (name[0] == '\0' || level <= 0 || distance < 0)
+        return false;
+
+    int index = find_leaderboard_entry(board, name);
+    if (index >= 0)
+    {
+        if (distance <= board->entries[index].distance)
+            return false;
+        board->root = remove_rank(board, board->root, index);
+        board->entries[index].level = level;
+        board->entries[index].distance = distance;
+    }
+    else
+    {
+        LeaderboardEntry entry = {{0}, level, distance};
+        snprintf(entry.name, sizeof(entry.name), "%s", name);
+        index = append_leaderboard_entry(board, &entry);
+        if (index < 0)
+            return false;
+    }
+    board->root = insert_rank(board, board->root, index);
+    return true;
+}
+
+void clear_leaderboard(Leaderboard *board) // Function definition
+{
+    board->count = 0;
+    board->root = -1;
+    if (board->by_name)
+        memset(board->by_name, 0xff, board->name_capacity * sizeof(int));
+}
+
+void free_leaderboard(Leaderboard *board) // Function definition
+{
+    free(board->entries);
+    free(board->nodes);
+    free(board->by_name);
+    *board = (Leaderboard){.root = -1, .priorities = board->priorities};
+}
+
+// Leaderboard implementations
+// Entry record shared by the snapshot and the journal: name length byte, name, then level and
+// distance as 32-bit integers
+int encode_leaderboard_record(const LeaderboardEntry *entry, unsigned char *out) // Function definition
+{
+    int name_length = (int)strlen(entry->name);
+    int32_t values[2] = {entry->level, entry->distance};
+    out[0] = (unsigned char)name_length;
+    memcpy(out + 1, entry->name, name_length);
+    memcpy(out + 1 + name_length, values, sizeof(values));
+    return 1 + name_length + (int)sizeof(values);
+}
+
+// Bytes used by the record at data, or -1 when it is cut short or malformed
+long decode_leaderboard_record(const unsigned char *data, long length, LeaderboardEntry *entry) // Function definition
+{
+    if (length < 1)
+        return -1;
+    int name_length = data[0];
+    int32_t values[2];
+    if (name_length == 0 || name_length >= (int)sizeof(entry->name) || 1 + name_length + (long)sizeof(values) > length)
+        return -1;
+    memcpy(entry->name, data + 1, name_length);
+    entry->name[name_length] = '\0';
+    memcpy(values, data + 1 + name_length, sizeof(values));
+    entry->level = values[0];
+    entry->distance = values[1];
+    return 1 + name_length + sizeof(values);
+}
+
+// Snapshot: "RBLB", version, count, then the entry records in rank order.
+// Read in one go and parsed from memory.
+bool read_leaderboard_file(Leaderboard *board, const char *path) // Function definition
+{
+    FILE *file = fopen(path, "rb");
+    if (!file)
+        return false;
+    fseek(file, 0, SEEK_END);
+    long length = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    unsigned char *data = length >= 12 ? malloc(length) : NULL;
+    bool ok = data && fread(data, 1, length, file) == (size_t)length;
+    fclose(file);
+
+    uint32_t version = 0, count = 0;
+    if (ok)
+    {
+        memcpy(&version, data + 4, sizeof(version));
+        memcpy(&count, data + 8, sizeof(count));
+        // A count the file cannot hold means it is corrupt; checked before it sizes anything
+        ok = memcmp(data, "RBLB", 4) == 0 && version == LEADERBOARD_VERSION &&
+             count <= (unsigned long)(length - 12) / LEADERBOARD_RECORD_MIN &&
+             count <= (uint32_t)(LEADERBOARD_MAX_ENTRIES - board->count) &&
+             reserve_leaderboard(board, board->count + (int)count);
+    }
+
+    long pos = 12;
+    for (uint32_t i = 0; ok && i < count; i++)
+    {
+        LeaderboardEntry entry;
+        long used = decode_leaderboard_record(data + pos, length - pos, &entry);
+        if (used < 0)
+        {
+            ok = false;
+            break;
+        }
+        pos += used;
+        if (find_leaderboard_entry(board, entry.name) < 0)
+            append_leaderboard_entry(board, &entry);
+    }
+    free(data);
+
+    board->root = build_ranks(board);
+    return ok;
+}
+
+// Temp file, fsync, then rename over the old snapshot: a crash leaves either the old or the new one
+bool write_leaderboard_file(const Leaderboard *board, const char *path) // Function definition
+{
+    char temp_path[300];
+    snprintf(temp_path, sizeof(temp_path), "%s.tmp", path);
+    FILE *file = fopen(temp_path, "wb");
+    if (!file)
+        return false;
+
+    uint32_t header[2] = {LEADERBOARD_VERSION, (uint32_t)board->count};
+    bool ok = fwrite("RBLB", 1, 4, file) == 4 && fwrite(header, sizeof(header), 1, file) == 1;
+    for (int rank = 1; ok && rank <= board->count; rank++)
+    {
+        unsigned char record[LEADERBOARD_RECORD_MAX];
+        int length = encode_leaderboard_record(&board->entries[leaderboard_at(board, rank)], record);
+        ok = fwrite(record, 1, length, file) == (size_t)length;
+    }
+    ok = sync_file(file) && ok;
+    ok = fclose(file) == 0 && ok;
+    if (!ok || !safe_rename(temp_path, path))
+    {
+        remove(temp_path);
+        return false;
+    }
+    return true;
+}
+
+// "name level distance" lines from leaderboard.txt
+bool import_legacy_leaderboard(Leaderboard *board, const char *path) // Function definition
+{
+    FILE *file = fopen(path, "r");
+    if (!file)
+        return false;
+
+    LeaderboardEntry entry;
+    while (fscanf(file, "%49s %d %d", entry.name, &entry.level, &entry.distance) == 3)
+    {
+        upsert_leaderboard(board, entry.name, entry.level, entry.distance);
+    }
+    fclose(file);
+    return true;
+}
+
+// Journal record: an entry record followed by an FNV-1a checksum of it. Appended and synced
+// on every game over; a torn record at the end fails its checksum and is ignored.
+bool append_leaderboard_journal(const char *path, const LeaderboardEntry *entry) // Function definition
+{
+    unsigned char record[LEADERBOARD_RECORD_MAX];
+    int length = encode_leaderboard_record(entry, record);
+    uint32_t checksum = checksum_bytes(record, length);
+    memcpy(record + length, &checksum, sizeof(checksum));
+    length += sizeof(checksum);
+
+    FILE *file = fopen(path, "ab");
+    if (!file)
+        return false;
+    bool ok = fwrite(record, 1, length, file) == (size_t)length;
+    ok = sync_file(file) && ok;
+    return fclose(file) == 0 && ok;
+}
+
+// Applies every intact journal record to the board and returns how many there were; torn is
+// set when bytes after the last intact record had to be ignored. Upserts keep the best run,
+// so replaying a journal that was already compacted is harmless.
+int replay_leaderboard_journal(Leaderboard *board, const char *path, bool *torn) // Function definition
+{
+    *torn = false;
+    FILE *file = fopen(path, "rb");
+    if (!file)
+        return 0;
+
+    int records = 0;
+    unsigned char record[LEADERBOARD_RECORD_MAX];
+    int length;
+    while ((length = fgetc(file)) != EOF)
+    {
+        record[0] = (unsigned char)length;
+        int rest = length + 8 + 4;
+        LeaderboardEntry entry;
+        uint32_t stored;
+        if (length == 0 || 1 + rest > LEADERBOARD_RECORD_MAX || fread(record + 1, 1, rest, file) != (size_t)rest)
+        {
+            *torn = true;
+            break;
+        }
+        memcpy(&stored, record + 1 + length + 8, sizeof(stored));
+        if (stored != checksum_bytes(record, 1 + length + 8) || decode_leaderboard_record(record, 1 + length + 8, &entry) < 0)
+        {
+            *torn = true;
+            break;
+        }
+        upsert_leaderboard(board, entry.name, entry.level, entry.distance);
+        records++;
+    }
+    fclose(file);
+    return records;
+}
+
+// Builds snapshot + retired journal into a new snapshot, then drops the journal. Runs on the
+// compaction thread with its own board; a crash at any point leaves files load_leaderboard() can use.
+bool compact_leaderboard(const char *snapshot_path, const char *journal_path) // Function definition
+{
+    Leaderboard board = {.root = -1};
+    rng_seed(&board.priorities, (uint64_t)time(NULL), 6);
+    bool torn;
+    read_leaderboard_file(&board, snapshot_path);
+    replay_leaderboard_journal(&board, journal_path, &torn);
+    bool ok = write_leaderboard_file(&board, snapshot_path);
+    if (ok)
+        remove(journal_path);
+    free_leaderboard(&board);
+    return ok;
+}
+
+#ifdef _WIN32
+DWORD WINAPI compaction_thread_main(LPVOID arg) // Function definition
+{
+    LeaderboardCompaction *job = arg;
+    compact_leaderboard(job->snapshot_path, job->journal_path);
+    atomic_store(&job->done, true);
+    return 0;
+}
+#else
+void *compaction_thread_main(void *arg) // Function definition
+{
+    LeaderboardCompaction *job = arg;
+    compact_leaderboard(job->snapshot_path, job->journal_path);
+    atomic_store(&job->done, true);
+    return NULL;
+}
+#endif
+
+// Retires the live journal and folds it into the snapshot in the background
+void start_leaderboard_compaction() // Function definition
+{
+    LeaderboardCompaction *job = &leaderboard_compaction;
+    if (job->running && atomic_load(&job->done))
+        finish_leaderboard_compaction(); // The last one is over, only its thread is left to join
+    if (job->running)
+        return;
+
+    // A retired journal left by an interrupted compaction is folded in first
+    FILE *leftover = fopen(get_retired_journal_path(), "rb");
+    if (leftover)
+        fclose(leftover);
+    else if (safe_rename(get_leaderboard_journal_path(), get_retired_journal_path()))
+        leaderboard_journal_records = 0;
+    else
+        return;
+
+    snprintf(job->snapshot_path, sizeof(job->snapshot_path), "%s", get_leaderboard_path());
+    snprintf(job->journal_path, sizeof(job->journal_path), "%s", get_retired_journal_path());
+    atomic_store(&job->done, false);
+#ifdef _WIN32
+    job->thread = CreateThread(NULL, 0, compaction_thread_main, job, 0, NULL);
+    job->running = job->thread != NULL;
+#else
+    job->running = pthread_create(&job->thread, NULL, compaction_thread_main, job) == 0;
+#endif
+    if (!job->running)
+        compact_leaderboard(job->snapshot_path, job->journal_path);
+}
+
+// Waits for a compaction in flight; registered with atexit so quitting never cuts one short
+void finish_leaderboard_compaction() // Function definition
+{
+    LeaderboardCompaction *job = &leaderboard_compaction;
+    if (!job->running)
+        return;
+#ifdef _WIN32
+    WaitForSingleObject(job->thread, INFINITE);
+    CloseHandle(job->thread);
+#else
+    pthread_join(job->thread, NULL);
+#endif
+    job->running = false;
+}
+
+void load_leaderboard() // Function definition
+{
+    finish_leaderboard_compaction();
+    clear_leaderboard(&leaderboard);
+    if (leaderboard.priorities.inc == 0)
+        rng_seed(&leaderboard.priorities, (uint64_t)time(NULL), 5);
+
+    if (!read_leaderboard_file(&leaderboard, get_leaderboard_path()))
+    {
+        // First start after the switch to the binary store: carry the old top ten over
+        clear_leaderboard(&leaderboard);
+        if (import_legacy_leaderboard(&leaderboard, get_legacy_leaderboard_path()))
+            write_leaderboard_file(&leaderboard, get_leaderboard_path());
+    }
+
+    // Results since the last compaction, oldest journal first. A torn journal is compacted
+    // right away, since records appended after the damage could never be read back.
+    bool retired_torn, torn;
+    int retired = replay_leaderboard_journal(&leaderboard, get_retired_journal_path(), &retired_torn);
+    leaderboard_journal_records = replay_leaderboard_journal(&leaderboard, get_leaderboard_journal_path(), &torn);
+    if (retired > 0 || retired_torn || torn || leaderboard_journal_records >= LEADERBOARD_COMPACT_RECORDS)
+        start_leaderboard_compaction();
+}
+
+// Records the finished run and returns the player's rank (0 when the run could not be ranked).
+// Costs one small journal append however big the board is.
+int add_to_leaderboard(Game *game) // Function definition
+{
+    if (upsert_leaderboard(&leaderboard, game->player.name, game->player.level, game->player.score))
+    {
+        int index = find_leaderboard_entry(&leaderboard, game->player.name);
+        profile_begin();
+        bool appended = append_leaderboard_journal(get_leaderboard_journal_path(), &leaderboard.entries[index]);
+        profile_end(PHASE_FILE_IO);
+        if (appended && ++leaderboard_journal_records >= LEADERBOARD_COMPACT_RECORDS)
+        {
+            start_leaderboard_compaction();
+        }
+    }
+    int index = find_leaderboard_entry(&leaderboard, game->player.name);
+    return index >= 0 ? leaderboard_rank(&leaderboard, index) : 0;
+}
+
+void show_leaderboard()
+{ // Function definition
+    int selected = 0;
+
+    while (1)
+    {
+        clear_screen();
+
+        // Header with color
+        move_cursor(0, 0);
+        output_printf("\033[1;36m=== LEADERBOARD ===\033[0m"); // Cyan header
+        move_cursor(0, 1);
+        output_printf("\033[1;94mRank  Name           Level  Distance\033[0m"); // Yellow column headers
+
+        // Leaderboard entries: the top of the ranking
+        int shown = leaderboard.count < MAX_LEADERBOARD ? leaderboard.count : MAX_LEADERBOARD;
+        for (int i = 0; i < shown; i++)
+        {
+            const LeaderboardEntry *entry = &leaderboard.entries[leaderboard_at(&leaderboard, i + 1)];
+            move_cursor(0, 2 + i);
+
+            // Apply medal-based color styling
+            if (i == 0)
+                output_printf("\033[1;93m"); // Gold (bright yellow)
+            else if (i == 1)          // Function definition
+                output_printf("\033[1;97m"); // Silver (bright white)
+            else if (i == 2)          // Function definition
+                output_printf("\033[1;30m"); // Bronze (regular yellow)
+            else
+                output_printf("\033[0;250m"); // Regular white/gray
+
+            output_printf("%2d.   %-12s   %3d     %5d\033[0m",
+                   i + 1,
+                   entry->name,
+                   entry->level,
+                   entry->distance);
+        }
+        if (leaderboard.count > shown)
+        {
+            move_cursor(0, 2 + shown);
+            output_printf("\033[0;37m      ... %d players ranked\033[0m", leaderboard.count);
+            shown++;
+        }
+
+        // Menu options - positioned below with colors
+        int menu_pos = 3 + shown;
+        move_cursor(0, menu_pos);
+        output_printf("\n"); // Spacer
+
+        // Return to Menu option
+        move_cursor(0, menu_pos + 1);
+        if (selected == 0)
+        {
+            output_printf("\033[1;92m> "); // Bright green for selection
+        }
+        else
+        {
+            output_printf("\033[0;37m  "); // Normal white
+        }
+        output_printf("Return to Menu\033[0m");
+
+        // Exit Game option
+        move_cursor(0, menu_pos + 2);
+        if (selected == 1)
+        {
+            output_printf("\033[1;32m> ");
+        }
+        else
+        {
+            output_printf("\033[0;37m  ");
+        }
+        output_printf("Exit Game\033[0m");
+
+        // Input handling
+        end_frame();
+        char ch = get_key();
+        switch (tolower(ch))
+        {
+        case 'w':
+            selected = (selected - 1 + 2) % 2;
+            break;
+        case 's':
+            selected = (selected + 1) % 2;
+            break;
+        case '\r': // Enter
+        case '\n':
+            if (selected == 0)
+            {
+                output_printf("\033[0m"); // Reset colors before returning
+                return;
+            }
+            else
+            {
+                exit(0);
+            }
+            break;
+        }
+
+        end_frame(); // Ensure all output is displayed
+    }
+}
+// Save/load implementations
+// FNV-1a over a byte range
+uint32_t checksum_bytes(const void *data, size_t length) // Function definition
+{
+    const unsigned char *bytes = data;
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; i++)
+    {
+        hash = (hash ^ bytes[i]) * 16777619u;
+    }
+    return hash;
+}
+
+void write_bytes(ByteWriter *writer, const void *data, size_t length) // Function definition
+{
+    if (!writer->ok)
+        return;
+    if (writer->length + length > writer->capacity)
+    {
+        size_t capacity = writer->capacity ? writer->capacity : 1024;
+        while (capacity < writer->length + length)
+            capacity *= 2;
+        unsigned char *grown = realloc(writer->data, capacity);
+        if (!grown)
+        {
+            writer->ok = false;
+            return;
+        }
+        writer->data = grown;
+        writer->capacity = capacity;
+    }
+    memcpy(writer->data + writer->length, data, length);
+    writer->length += length;
+}
+
+void write_u8(ByteWriter *writer, uint8_t value) // Function definition
+{
+    write_bytes(writer, &value, 1);
+}
+
+void write_u16(ByteWriter *writer, uint16_t value) // Function definition
+{
+    unsigned char bytes[2] = {value, value >> 8};
+    write_bytes(writer, bytes, sizeof(bytes));
+}
+
+void write_u32(ByteWriter *writer, uint32_t value) // Function definition
+{
+    unsigned char bytes[4] = {value, value >> 8, value >> 16, value >> 24};
+    write_bytes(writer, bytes, sizeof(bytes));
+}
+
+void write_u64(ByteWriter *writer, uint64_t value) // Function definition
+{
+    write_u32(writer, (uint32_t)value);
+    write_u32(writer, (uint32_t)(value >> 32));
+}
+
+bool read_bytes(ByteReader *reader, void *out, size_t length) // Function definition
+{
+    if (!reader->ok || reader->length - reader->pos < length)
+    {
+        reader->ok = false;
+        return false;
+    }
+    memcpy(out, reader->data + reader->pos, length);
+    reader->pos += length;
+    return true;
+}
+
+uint8_t read_u8(ByteReader *reader) // Function definition
+{
+    uint8_t value = 0;
+    read_bytes(reader, &value, 1);
+    return value;
+}
+
+uint16_t read_u16(ByteReader *reader) // Function definition
+{
+    unsigned char bytes[2] = {0};
+    read_bytes(reader, bytes, sizeof(bytes));
+    return (uint16_t)(bytes[0] | (bytes[1] << 8));
+}
+
+uint32_t read_u32(ByteReader *reader) // Function definition
+{
+    unsigned char bytes[4] = {0};
+    read_bytes(reader, bytes, sizeof(bytes));
+    return bytes[0] | (bytes[1] << 8) | ((uint32_t)bytes[2] << 16) | ((uint32_t)bytes[3] << 24);
+}
+
+uint64_t read_u64(ByteReader *reader) // Function definition
+{
+    uint64_t low = read_u32(reader);
+    return low | ((uint64_t)read_u32(reader) << 32);
+}
+
+// Maps a whole file read-only; NULL when it is missing or empty
+const unsigned char *map_file(const char *path, size_t *length) // Function definition
+{
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+        return NULL;
+    LARGE_INTEGER size;
+    HANDLE mapping = NULL;
+    const unsigned char *data = NULL;
+    if (GetFileSizeEx(file, &size) && size.QuadPart > 0)
+        mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (mapping)
+    {
+        data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        CloseHandle(mapping); // The view keeps the mapping alive
+    }
+    CloseHandle(file);
+    *length = data ? (size_t)size.QuadPart : 0;
+    return data;
+#else
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+    struct stat info;
+    void *data = MAP_FAILED;
+    if (fstat(fd, &info) == 0 && info.st_size > 0)
+        data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd); // The mapping stays valid after the descriptor is gone
+    if (data == MAP_FAILED)
+        return NULL;
+    *length = info.st_size;
+    return data;
+#endif
+}
+
+void unmap_file(const unsigned char *data, size_t length) // Function definition
+{
+#ifdef _WIN32
+    (void)length;
+    UnmapViewOfFile(data);
+#else
+    munmap((void *)data, length);
+#endif
+}
+
+// The map stream as of the scroll front, which is what a save stores; rows generated ahead
+// are made again, and rows behind the map are generated from it on the way back
+const Rng *map_stream_front(const Game *game) // Function definition
+{
+    return game->ahead_next < game->ahead_count ? &game->ahead_rng[game->ahead_next] : &game->rng.map;
+}
+
+// Payload: player, progress, generator state, the map as (run length, tile) pairs and the
+// live enemies only. Every number is written little-endian so the layout never depends on
+// struct padding.
+void encode_save(ByteWriter *writer, Game *game) // Function definition
+{
+    const Player *p = &game->player;
+    int32_t stats[] = {p->x, p->y, p->hp, p->max_hp, p->strength, p->level, p->xp, p->xp_to_level, p->score};
+    for (size_t i = 0; i < sizeof(stats) / sizeof(stats[0]); i++)
+        write_u32(writer, (uint32_t)stats[i]);
+    uint8_t name_length = (uint8_t)strlen(p->name);
+    write_u8(writer, name_length);
+    write_bytes(writer, p->name, name_length);
+
+    write_u32(writer, (uint32_t)game->world_offset);
+    write_u32(writer, (uint32_t)game->furthest_offset);
+    write_u32(writer, (uint32_t)game->move_count);
+
+    // Generator state, so a continued game plays on exactly as it would have
+    const Rng *streams[] = {map_stream_front(game), &game->rng.spawn, &game->rng.ai, &game->rng.policy};
+    write_u64(writer, game->rng.seed);
+    for (int i = 0; i < 4; i++)
+    {
+        write_u64(writer, streams[i]->state);
+        write_u64(writer, streams[i]->inc);
+    }
+
+    // Runs continue across row ends, in logical row order
+    write_u16(writer, (uint16_t)game->width);
+    write_u16(writer, (uint16_t)game->height);
+    char tile = map_row(game, 0)[0];
+    int run = 0;
+    for (int y = 0; y < game->height; y++)
+    {
+        const char *row = map_row(game, y);
+        for (int x = 0; x < game->width; x++)
+        {
+            if (row[x] != tile || run == 255)
+            {
+                write_u8(writer, (uint8_t)run);
+                write_u8(writer, (uint8_t)tile);
+                tile = row[x];
+                run = 0;
+            }
+            run++;
+        }
+    }
+    write_u8(writer, (uint8_t)run);
+    write_u8(writer, (uint8_t)tile);
+
+    write_u32(writer, (uint32_t)game->enemies.count);
+    for (int i = 0; i < game->enemies.count; i++)
+    {
+        const Enemy *enemy = &game->enemies.items[i];
+        write_u16(writer, (uint16_t)enemy->x);
+        write_u16(writer, (uint16_t)enemy->y);
+        write_u32(writer, (uint32_t)enemy->hp);
+        write_u32(writer, (uint32_t)enemy->strength);
+        write_u32(writer, (uint32_t)enemy->xp_value);
+        write_u8(writer, enemy->is_boss);
+    }
+}
+
+bool decode_save(ByteReader *reader, Game *game) // Function definition
+{
+    Player p = {0};
+    int32_t *stats[] = {&p.x, &p.y, &p.hp, &p.max_hp, &p.strength, &p.level, &p.xp, &p.xp_to_level, &p.score};
+    for (size_t i = 0; i < sizeof(stats) / sizeof(stats[0]); i++)
+        *stats[i] = (int32_t)read_u32(reader);
+    uint8_t name_length = read_u8(reader);
+    if (name_length >= sizeof(p.name) || !read_bytes(reader, p.name, name_length))
+        return false;
+    p.name[name_length] = '\0';
+
+    int world_offset = (int32_t)read_u32(reader);
+    int furthest_offset = (int32_t)read_u32(reader);
+    int move_count = (int32_t)read_u32(reader);
+
+    GameRandom rng;
+    Rng *streams[] = {&rng.map, &rng.spawn, &rng.ai, &rng.policy};
+    rng.seed = read_u64(reader);
+    for (int i = 0; i < 4; i++)
+    {
+        streams[i]->state = read_u64(reader);
+        streams[i]->inc = read_u64(reader);
+    }
+
+    int width = read_u16(reader);
+    int height = read_u16(reader);
+    if (!reader->ok || width < MIN_MAP_WIDTH || height < MIN_MAP_HEIGHT || world_offset < 0 ||
+        furthest_offset < world_offset || p.x < 0 || p.x >= width || p.y < 0 || p.y >= height)
+        return false;
+    size_t cells = (size_t)width * height;
+    if (cells > (reader->length - reader->pos) / 2 * 255) // Each (run, tile) pair covers at most 255 cells
+        return false;
+    char *tiles = malloc(cells);
+    if (!tiles)
+        return false;
+    for (size_t i = 0; i < cells;)
+    {
+        int run = read_u8(reader);
+        char tile = (char)read_u8(reader);
+        if (!reader->ok || run == 0 || i + run > cells)
+        {
+            free(tiles);
+            return false;
+        }
+        memset(tiles + i, tile, run);
+        i += run;
+    }
+
+    // Positions index the occupancy grid and the flow field, so every one must be on the map
+    uint32_t enemy_count = read_u32(reader);
+    bool on_map = reader->ok && enemy_count <= MAX_ENEMIES && enemy_count <= (reader->length - reader->pos) / 17;
+    ByteReader scan = *reader;
+    for (uint32_t i = 0; on_map && i < enemy_count; i++)
+    {
+        on_map = read_u16(&scan) < width && read_u16(&scan) < height;
+        scan.pos += 13; // hp, strength, xp_value, is_boss
+    }
+    if (!on_map ||
+        ((width != game->width || height != game->height) && !allocate_grid(game, width, height)))
+    {
+        free(tiles);
+        return false;
+    }
+
+    // Everything checks out: replace the running game
+    game->player = p;
+    game->world_offset = world_offset;
+    game->furthest_offset = furthest_offset;
+    game->move_count = move_count;
+    game->rng = rng;
+    game->map_origin = rng.map; // Wind the stream back past every row generated so far
+    rng_advance(&game->map_origin, 0 - row_stream_draws(game, furthest_offset + height));
+    game->ahead_next = game->ahead_count = 0;
+    import_map(game, tiles);
+    free(tiles);
+    reset_enemies(game);
+    reserve_enemies(&game->enemies, (int)enemy_count);
+    for (uint32_t i = 0; i < enemy_count; i++)
+    {
+        Enemy enemy;
+        enemy.x = read_u16(reader);
+        enemy.y = read_u16(reader);
+        enemy.hp = (int32_t)read_u32(reader);
+        enemy.strength = (int32_t)read_u32(reader);
+        enemy.xp_value = (int32_t)read_u32(reader);
+        enemy.is_boss = read_u8(reader) != 0;
+        place_enemy(game, enemy);
+    }
+    game->turn_count = 0;
+    game->death_turn = -1;
+    game->death_cause = NULL;
+    return reader->ok;
+}
+
+// Header: "RBSV", version, payload length, payload checksum (all 32-bit little-endian).
+// Points payload at the checked bytes on success.
+bool check_save_header(const unsigned char *data, size_t length, ByteReader *payload) // Function definition
+{
+    ByteReader header = {data, length, 0, true};
+    char magic[4];
+    read_bytes(&header, magic, sizeof(magic));
+    uint32_t version = read_u32(&header);
+    uint32_t payload_length = read_u32(&header);
+    uint32_t checksum = read_u32(&header);
+    if (!header.ok || memcmp(magic, "RBSV", 4) != 0 || version != SAVE_VERSION ||
+        payload_length != length - SAVE_HEADER_SIZE ||
+        checksum_bytes(data + SAVE_HEADER_SIZE, payload_length) != checksum)
+        return false;
+    *payload = (ByteReader){data + SAVE_HEADER_SIZE, payload_length, 0, true};
+    return true;
+}
+
+void encode_save_header(unsigned char *header, const ByteWriter *payload) // Function definition
+{
+    ByteWriter fields = {header, 0, SAVE_HEADER_SIZE, true};
+    write_bytes(&fields, "RBSV", 4);
+    write_u32(&fields, SAVE_VERSION);
+    write_u32(&fields, (uint32_t)payload->length);
+    write_u32(&fields, checksum_bytes(payload->data, payload->length));
+}
+
+// Header plus an encoded payload, through a temp file, fsync and rename: a crash while
+// saving keeps the previous save intact
+bool write_save_file(const char *path, const ByteWriter *payload) // Function definition
+{
+    if (!payload->ok)
+        return false;
+    unsigned char header[SAVE_HEADER_SIZE];
+    encode_save_header(header, payload);
+
+    char temp_path[300];
+    snprintf(temp_path, sizeof(temp_path), "%s.tmp", path);
+    FILE *file = fopen(temp_path, "wb");
+    if (!file)
+        return false;
+    bool success = fwrite(header, 1, sizeof(header), file) == sizeof(header) &&
+                   fwrite(payload->data, 1, payload->length, file) == payload->length;
+    success = sync_file(file) && success;
+    success = fclose(file) == 0 && success;
+    success = success && safe_rename(temp_path, path);
+    if (!success)
+        remove(temp_path);
+    return success;
+}
+
+// With the autosave writer running the save goes through it (so an older queued snapshot can
+// never land on top) and this waits for the result; otherwise it is written right here
+bool save_game(Game *game)
+{ // Function definition
+    if (game->player.hp <= 0)
+    {
+        // printf("DEBUG: Not saving - player is dead\n");
+        return false;
+    }
+    profile_begin();
+    bool success;
+    if (autosaver.running)
+    {
+        success = request_autosave(game) && wait_autosave();
+    }
+    else
+    {
+        ByteWriter payload = {NULL, 0, 0, true};
+        encode_save(&payload, game);
+        success = write_save_file(get_save_file_path(), &payload);
+        free(payload.data);
+    }
+    profile_end(PHASE_FILE_IO);
+    return success;
+}
+
+// Reads the save in place through a read-only mapping; the game is only touched once the
+// version and checksum have been verified and the payload decoded cleanly
+bool load_game(Game *game)
+{ // Function definition
+    char *path = get_save_file_path();
+    size_t length;
+    profile_begin();
+    const unsigned char *data = map_file(path, &length);
+    if (!data)
+    {
+        profile_end(PHASE_FILE_IO);
+        return false;
+    }
+
+    ByteReader payload;
+    bool success = check_save_header(data, length, &payload) && decode_save(&payload, game);
+    unmap_file(data, length);
+    profile_end(PHASE_FILE_IO);
+
+    if (success && game->player.hp <= 0)
+    {
+        remove(path);
+        return false;
+    }
+    return success;
+}
+
+bool save_file_exists()
+{ // Function definition
+    size_t length;
+    const unsigned char *data = map_file(get_save_file_path(), &length);
+    if (data)
+    {
+        // Verify it is a save this version can read
+        ByteReader payload;
+        bool valid = check_save_header(data, length, &payload);
+        unmap_file(data, length);
+        return valid;
+    }
+    return false;
+}
+
+// Autosave implementations
+void lock_autosave() // Function definition
+{
+#ifdef _WIN32
+    EnterCriticalSection(&autosaver.lock);
+#else
+    pthread_mutex_lock(&autosaver.lock);
+#endif
+}
+
+void unlock_autosave() // Function definition
+{
+#ifdef _WIN32
+    LeaveCriticalSection(&autosaver.lock);
+#else
+    pthread_mutex_unlock(&autosaver.lock);
+#endif
+}
+
+#ifdef _WIN32
+#define WAIT_AUTOSAVE(cond) SleepConditionVariableCS(&autosaver.cond, &autosaver.lock, INFINITE)
+#define WAKE_AUTOSAVE(cond) WakeAllConditionVariable(&autosaver.cond)
+#else
+#define WAIT_AUTOSAVE(cond) pthread_cond_wait(&autosaver.cond, &autosaver.lock)
+#define WAKE_AUTOSAVE(cond) pthread_cond_broadcast(&autosaver.cond)
+#endif
+
+// Writer thread: takes the newest snapshot, writes it, repeats; drains what is queued before stopping
+#ifdef _WIN32
+DWORD WINAPI autosave_thread_main(LPVOID arg) // Function definition
+#else
+void *autosave_thread_main(void *arg) // Function definition
+#endif
+{
+    (void)arg;
+    const char *path = get_save_file_path();
+    lock_autosave();
+    while (1)
+    {
+        while (!autosaver.pending_ready && !autosaver.stop)
+            WAIT_AUTOSAVE(work);
+        if (!autosaver.pending_ready)
+            break;
+
+        ByteWriter snapshot = autosaver.pending;
+        autosaver.pending = autosaver.writing;
+        autosaver.writing = snapshot;
+        autosaver.pending_ready = false;
+        autosaver.busy = true;
+        unlock_autosave();
+
+        double start = now_seconds();
+        bool ok = write_save_file(path, &autosaver.writing);
+        double elapsed = now_seconds() - start;
+
+        lock_autosave();
+        autosaver.busy = false;
+        autosaver.last_ok = ok;
+        if (ok)
+            autosaver.written++;
+        else
+            autosaver.failed++;
+        autosaver.write_total += elapsed;
+        if (elapsed > autosaver.write_max)
+            autosaver.write_max = elapsed;
+        WAKE_AUTOSAVE(idle);
+    }
+    unlock_autosave();
+#ifdef _WIN32
+    return 0;
+#else
+    return NULL;
+#endif
+}
+
+void start_autosave() // Function definition
+{
+    if (autosaver.running || autosave_turns <= 0)
+        return;
+    autosaver.stop = false;
+    autosaver.pending_ready = false;
+    autosaver.busy = false;
+    autosaver.pending = (ByteWriter){NULL, 0, 0, true};
+    autosaver.writing = (ByteWriter){NULL, 0, 0, true};
+#ifdef _WIN32
+    InitializeCriticalSection(&autosaver.lock);
+    InitializeConditionVariable(&autosaver.work);
+    InitializeConditionVariable(&autosaver.idle);
+    autosaver.thread = CreateThread(NULL, 0, autosave_thread_main, NULL, 0, NULL);
+    autosaver.running = autosaver.thread != NULL;
+#else
+    pthread_mutex_init(&autosaver.lock, NULL);
+    pthread_cond_init(&autosaver.work, NULL);
+    pthread_cond_init(&autosaver.idle, NULL);
+    autosaver.running = pthread_create(&autosaver.thread, NULL, autosave_thread_main, NULL) == 0;
+#endif
+}
+
+// Hands the writer a snapshot of the game. The only work on the game thread is encoding a
+// few hundred bytes into a reused buffer; a snapshot the writer has not taken yet is replaced.
+bool request_autosave(Game *game) // Function definition
+{
+    if (!autosaver.running || game->player.hp <= 0)
+        return false;
+
+    profile_begin();
+    double start = now_seconds();
+    lock_autosave();
+    if (autosaver.pending_ready)
+        autosaver.coalesced++;
+    autosaver.pending.length = 0;
+    autosaver.pending.ok = true;
+    encode_save(&autosaver.pending, game);
+    autosaver.pending_ready = true;
+    autosaver.requested++;
+    unlock_autosave();
+    WAKE_AUTOSAVE(work); // After unlocking, so the writer does not wake straight into the lock
+    double stall = now_seconds() - start;
+
+    autosaver.stall_total += stall;
+    if (stall > autosaver.stall_max)
+        autosaver.stall_max = stall;
+    autosaver.last_turn = game->turn_count;
+    autosaver.last_time = now_seconds();
+    profile_end(PHASE_FILE_IO);
+    return true;
+}
+
+// Blocks until everything queued is on disk; returns whether the last write worked
+bool wait_autosave() // Function definition
+{
+    if (!autosaver.running)
+        return true;
+    lock_autosave();
+    while (autosaver.pending_ready || autosaver.busy)
+        WAIT_AUTOSAVE(idle);
+    bool ok = autosaver.last_ok;
+    unlock_autosave();
+    return ok;
+}
+
+// Drops a queued snapshot and waits out a write in progress, so the save file can be removed
+// without an autosave bringing it back
+void cancel_autosave() // Function definition
+{
+    if (!autosaver.running)
+        return;
+    lock_autosave();
+    autosaver.pending_ready = false;
+    while (autosaver.busy)
+        WAIT_AUTOSAVE(idle);
+    unlock_autosave();
+}
+
+// Called after each batch of turns: autosaves every autosave_turns turns or autosave_seconds
+void maybe_autosave(Game *game) // Function definition
+{
+    if (!autosaver.running)
+        return;
+    if (game->turn_count < autosaver.last_turn)
+        autosaver.last_turn = 0; // A new run started
+    if (game->turn_count - autosaver.last_turn >= autosave_turns ||
+        (autosave_seconds > 0 && now_seconds() - autosaver.last_time >= autosave_seconds &&
+         game->turn_count != autosaver.last_turn))
+    {
+        request_autosave(game);
+    }
+}
+
+void stop_autosave() // Function definition
+{
+    if (!autosaver.running)
+        return;
+    lock_autosave();
+    autosaver.stop = true;
+    WAKE_AUTOSAVE(work);
+    unlock_autosave();
+#ifdef _WIN32
+    WaitForSingleObject(autosaver.thread, INFINITE);
+    CloseHandle(autosaver.thread);
+    DeleteCriticalSection(&autosaver.lock);
+#else
+    pthread_join(autosaver.thread, NULL);
+    pthread_mutex_destroy(&autosaver.lock);
+    pthread_cond_destroy(&autosaver.work);
+    pthread_cond_destroy(&autosaver.idle);
+#endif
+    autosaver.running = false;
+    free(autosaver.pending.data);
+    free(autosaver.writing.data);
+    if (report_autosave_stats)
+        report_autosave(stderr);
+}
+
+void report_autosave(FILE *stream) // Function definition
+{
+    double requested = autosaver.requested ? (double)autosaver.requested : 1.0;
+    double written = autosaver.written ? (double)autosaver.written : 1.0;
+    fprintf(stream, "autosave: requested=%llu written=%llu coalesced=%llu failed=%llu\n",
+            autosaver.requested, autosaver.written, autosaver.coalesced, autosaver.failed);
+    fprintf(stream, "autosave: game thread stall avg=%.1fus max=%.1fus, writer avg=%.2fms max=%.2fms\n",
+            autosaver.stall_total / requested * 1e6, autosaver.stall_max * 1e6,
+            autosaver.write_total / written * 1e3, autosaver.write_max * 1e3);
+}
+
+// Spectator implementations
+// Appends one cell, moving the cursor and switching color only when needed (as present_frame() does)
+void encode_spectator_cell(ByteWriter *out, SpectatorCursor *cursor, int x, int y, ScreenCell cell) // Function definition
+{
+    if (cursor->x != x || cursor->y != y)
+    {
+        char move[32];
+        int length = snprintf(move, sizeof(move), "\033[%d;%dH", y + 1, x + 1);
+        write_bytes(out, move, length);
+    }
+    if (cell.color != cursor->color)
+    {
+        write_bytes(out, color_codes[cell.color], strlen(color_codes[cell.color]));
+        cursor->color = cell.color;
+    }
+    write_u8(out, (uint8_t)cell.glyph);
+    cursor->x = x + 1;
+    cursor->y = y;
+}
+
+// Resets the color and parks the cursor below the HUD
+void finish_spectator_frame(ByteWriter *out, SpectatorCursor *cursor, int height) // Function definition
+{
+    if (cursor->color != COLOR_DEFAULT)
+        write_bytes(out, color_codes[COLOR_DEFAULT], strlen(color_codes[COLOR_DEFAULT]));
+    char move[32];
+    int length = snprintf(move, sizeof(move), "\033[%d;1H", height + 1);
+    write_bytes(out, move, length);
+}
+
+// The whole published frame from a cleared screen, the same bytes present_frame() writes for it
+// after a clear. It starts with ESC, which also ends any escape sequence a dropped backlog cut
+// short. Called with the lock held.
+void encode_spectator_full(ByteWriter *out) // Function definition
+{
+    static const char clear[] = "\033[0m\033[2J\033[H";
+    out->length = 0;
+    out->ok = true;
+    write_bytes(out, clear, sizeof(clear) - 1);
+    SpectatorCursor cursor = {-1, -1, -1};
+    for (int y = 0; y < spectators.height; y++)
+    {
+        for (int x = 0; x < spectators.width; x++)
+        {
+            ScreenCell cell = spectators.shown[y][x];
+            if (cell.glyph != ' ' || cell.color != COLOR_DEFAULT)
+                encode_spectator_cell(out, &cursor, x, y, cell);
+        }
+    }
+    finish_spectator_frame(out, &cursor, spectators.height);
+}
+
+#ifdef __linux__
+// Listens on tcp:PORT (loopback only) or unix:PATH and starts the broadcaster thread
+bool start_spectator_server(const char *spec) // Function definition
+{
+    int fd = -1;
+    bool ok = false;
+    if (strncmp(spec, "tcp:", 4) == 0)
+    {
+        long port = atol(spec + 4);
+        fd = port > 0 && port <= 65535 ? socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0) : -1;
+        int on = 1;
+        struct sockaddr_in address = {0};
+        address.sin_family = AF_INET;
+        address.sin_port = htons((uint16_t)port);
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        ok = fd >= 0 && setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) == 0 &&
+             bind(fd, (struct sockaddr *)&address, sizeof(address)) == 0;
+        spectators.tcp = true;
+    }
+    else if (strncmp(spec, "unix:", 5) == 0)
+    {
+        const char *path = spec + 5;
+        struct sockaddr_un address = {0};
+        address.sun_family = AF_UNIX;
+        if (path[0] != '\0' && strlen(path) < sizeof(address.sun_path))
+        {
+            struct stat info;
+            if (stat(path, &info) == 0 && S_ISSOCK(info.st_mode))
+                unlink(path); // Left behind by an earlier run
+            snprintf(address.sun_path, sizeof(address.sun_path), "%s", path);
+            fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+            ok = fd >= 0 && bind(fd, (struct sockaddr *)&address, sizeof(address)) == 0;
+            if (ok)
+                snprintf(spectators.unix_path, sizeof(spectators.unix_path), "%s", path);
+        }
+    }
+
+    spectators.listen_fd = fd;
+    spectators.epoll_fd = ok && listen(fd, 16) == 0 ? epoll_create1(EPOLL_CLOEXEC) : -1;
+    spectators.wake_fd = spectators.epoll_fd >= 0 ? eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC) : -1;
+    struct epoll_event listen_event = {EPOLLIN, {.fd = fd}};
+    struct epoll_event wake_event = {EPOLLIN, {.fd = spectators.wake_fd}};
+    ok = spectators.wake_fd >= 0 && epoll_ctl(spectators.epoll_fd, EPOLL_CTL_ADD, fd, &listen_event) == 0 &&
+         epoll_ctl(spectators.epoll_fd, EPOLL_CTL_ADD, spectators.wake_fd, &wake_event) == 0;
+
+    spectators.diff = (ByteWriter){NULL, 0, 0, true};
+    spectators.broadcast = (ByteWriter){NULL, 0, 0, true};
+    spectators.full = (ByteWriter){NULL, 0, 0, true};
+    if (ok)
+    {
+        pthread_mutex_init(&spectators.lock, NULL);
+        ok = pthread_create(&spectators.thread, NULL, spectator_thread_main, NULL) == 0;
+        if (!ok)
+            pthread_mutex_destroy(&spectators.lock);
+    }
+    if (!ok)
+    {
+        if (fd >= 0)
+            close(fd);
+        if (spectators.epoll_fd >= 0)
+            close(spectators.epoll_fd);
+        if (spectators.wake_fd >= 0)
+            close(spectators.wake_fd);
+        if (spectators.unix_path[0])
+            unlink(spectators.unix_path);
+        spectators.unix_path[0] = '\0';
+        return false;
+    }
+    spectators.running = true;
+    return true;
+}
+
+void stop_spectator_server() // Function definition
+{
+    if (!spectators.running)
+        return;
+    pthread_mutex_lock(&spectators.lock);
+    spectators.stop = true;
+    pthread_mutex_unlock(&spectators.lock);
+    uint64_t one = 1;
+    ssize_t woke = write(spectators.wake_fd, &one, sizeof(one));
+    (void)woke;
+    pthread_join(spectators.thread, NULL);
+    pthread_mutex_destroy(&spectators.lock);
+
+    while (spectators.client_count > 0)
+        drop_spectator(spectators.client_count - 1);
+    close(spectators.listen_fd);
+    close(spectators.epoll_fd);
+    close(spectators.wake_fd);
+    if (spectators.unix_path[0])
+        unlink(spectators.unix_path);
+    free(spectators.diff.data);
+    free(spectators.broadcast.data);
+    free(spectators.full.data);
+    spectators.running = false;
+}
+
+// Called by draw_game() after it presents the frame. Only diffs against the last published
+// frame under the lock and pokes the broadcaster; all socket work happens on its thread.
+void publish_spectator_frame() // Function definition
+{
+    if (!spectators.running)
+        return;
+    pthread_mutex_lock(&spectators.lock);
+    bool changed = false;
+    if (screen_width != spectators.width || screen_height != spectators.height ||
+        spectators.diff.length > SPECTATOR_MAX_BACKLOG)
+    {
+        // New size, or diffs piling up: everyone starts over from a full frame
+        spectators.width = screen_width;
+        spectators.height = screen_height;
+        for (int y = 0; y < screen_height; y++)
+            memcpy(spectators.shown[y], back_buffer[y], screen_width * sizeof(ScreenCell));
+        spectators.diff.length = 0;
+        spectators.diff.ok = true;
+        spectators.resync = true;
+        changed = true;
+    }
+    else
+    {
+        SpectatorCursor cursor = {-1, -1, -1};
+        for (int y = 0; y < screen_height; y++)
+        {
+            for (int x = 0; x < screen_width; x++)
+            {
+                ScreenCell cell = back_buffer[y][x];
+                if (cell.glyph == spectators.shown[y][x].glyph && cell.color == spectators.shown[y][x].color)
+                    continue;
+                encode_spectator_cell(&spectators.diff, &cursor, x, y, cell);
+                spectators.shown[y][x] = cell;
+                changed = true;
+            }
+        }
+        if (changed)
+            finish_spectator_frame(&spectators.diff, &cursor, screen_height);
+    }
+    spectators.has_frame = true;
+    pthread_mutex_unlock(&spectators.lock);
+
+    if (changed)
+    {
+        uint64_t one = 1;
+        ssize_t woke = write(spectators.wake_fd, &one, sizeof(one));
+        (void)woke; // Fails only when the counter is already set, which wakes the broadcaster anyway
+    }
+}
+
+// Broadcaster thread: accepts spectators, fans out published frames and drains slow sockets
+void *spectator_thread_main(void *arg) // Function definition
+{
+    (void)arg;
+    struct epoll_event events[SPECTATOR_MAX_CLIENTS + 2];
+    while (1)
+    {
+        int ready = epoll_wait(spectators.epoll_fd, events, SPECTATOR_MAX_CLIENTS + 2, -1);
+        if (ready < 0 && errno != EINTR)
+            break;
+        for (int i = 0; i < ready; i++)
+        {
+            int fd = events[i].data.fd;
+            if (fd == spectators.listen_fd)
+            {
+                accept_spectators();
+            }
+            else if (fd == spectators.wake_fd)
+            {
+                broadcast_spectator_frame();
+            }
+            else
+            {
+                int index = find_spectator(fd);
+                if (index >= 0 && !serve_spectator(&spectators.clients[index], events[i].events))
+                    drop_spectator(index);
+            }
+        }
+
+        pthread_mutex_lock(&spectators.lock);
+        bool stop = spectators.stop;
+        pthread_mutex_unlock(&spectators.lock);
+        if (stop)
+            break;
+    }
+    return NULL;
+}
+
+// New clients start out watched for EPOLLOUT, so each gets a full frame as soon as it can take one
+void accept_spectators() // Function definition
+{
+    while (1)
+    {
+        int fd = accept(spectators.listen_fd, NULL, NULL);
+        if (fd < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return; // EAGAIN: no one else is waiting
+        }
+        if (spectators.client_count >= SPECTATOR_MAX_CLIENTS || fcntl(fd, F_SETFL, O_NONBLOCK) != 0 ||
+            fcntl(fd, F_SETFD, FD_CLOEXEC) != 0)
+        {
+            close(fd);
+            continue;
+        }
+        if (spectators.tcp)
+        {
+            int on = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+        }
+        struct epoll_event event = {EPOLLIN | EPOLLRDHUP | EPOLLOUT, {.fd = fd}};
+        if (epoll_ctl(spectators.epoll_fd, EPOLL_CTL_ADD, fd, &event) != 0)
+        {
+            close(fd);
+            continue;
+        }
+        spectators.clients[spectators.client_count++] = (SpectatorClient){fd, {NULL, 0, 0, true}, 0, true, true};
+    }
+}
+
+int find_spectator(int fd) // Function definition
+{
+    for (int i = 0; i < spectators.client_count; i++)
+    {
+        if (spectators.clients[i].fd == fd)
+            return i;
+    }
+    return -1;
+}
+
+// Watches for EPOLLOUT only while the client has something waiting
+bool watch_spectator(SpectatorClient *client) // Function definition
+{
+    bool want = client->sent < client->backlog.length || client->needs_full;
+    if (want == client->watching_output)
+        return true;
+    struct epoll_event event = {EPOLLIN | EPOLLRDHUP | (want ? EPOLLOUT : 0), {.fd = client->fd}};
+    client->watching_output = want;
+    return epoll_ctl(spectators.epoll_fd, EPOLL_CTL_MOD, client->fd, &event) == 0;
+}
+
+// Sends what the socket takes now and keeps the rest. A client that falls more than
+// SPECTATOR_MAX_BACKLOG behind loses its backlog and catches up with the next full frame.
+// Returns false when the client has to be dropped.
+bool send_to_spectator(SpectatorClient *client, const unsigned char *data, size_t length) // Function definition
+{
+    if (client->sent == client->backlog.length)
+    {
+        client->backlog.length = client->sent = 0;
+        while (length > 0)
+        {
+            ssize_t written = send(client->fd, data, length, MSG_NOSIGNAL | MSG_DONTWAIT);
+            if (written < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                if (errno == EAGAIN || errno == EWOULDBLOCK)
+                    break;
+                return false;
+            }
+            data += written;
+            length -= written;
+        }
+        if (length == 0)
+            return true;
+    }
+
+    if (client->backlog.length - client->sent + length > SPECTATOR_MAX_BACKLOG)
+    {
+        client->backlog.length = client->sent = 0;
+        client->needs_full = true;
+        return watch_spectator(client);
+    }
+    write_bytes(&client->backlog, data, length);
+    return client->backlog.ok && watch_spectator(client);
+}
+
+// The socket has room again: sends the backlog, then a full frame if the client is owed one
+bool flush_spectator(SpectatorClient *client) // Function definition
+{
+    while (client->sent < client->backlog.length)
+    {
+        ssize_t written = send(client->fd, client->backlog.data + client->sent, client->backlog.length - client->sent,
+                               MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (written < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+        client->sent += written;
+    }
+    client->backlog.length = client->sent = 0;
+
+    if (client->needs_full)
+    {
+        pthread_mutex_lock(&spectators.lock);
+        bool has_frame = spectators.has_frame;
+        if (has_frame)
+            encode_spectator_full(&spectators.full);
+        pthread_mutex_unlock(&spectators.lock);
+        if (has_frame)
+        {
+            client->needs_full = false;
+            return spectators.full.ok && send_to_spectator(client, spectators.full.data, spectators.full.length) &&
+                   watch_spectator(client);
+        }
+    }
+    return watch_spectator(client);
+}
+
+// Spectators only watch: anything they send is read and thrown away
+bool serve_spectator(SpectatorClient *client, uint32_t events) // Function definition
+{
+    if (events & (EPOLLERR | EPOLLHUP | EPOLLRDHUP))
+        return false;
+    if (events & EPOLLIN)
+    {
+        char discard[256];
+        ssize_t got = recv(client->fd, discard, sizeof(discard), MSG_DONTWAIT);
+        if (got == 0 || (got < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+            return false;
+    }
+    if (events & EPOLLOUT)
+        return flush_spectator(client);
+    return true;
+}
+
+void drop_spectator(int index) // Function definition
+{
+    SpectatorClient *client = &spectators.clients[index];
+    close(client->fd); // Also takes it out of the epoll set
+    free(client->backlog.data);
+    spectators.clients[index] = spectators.clients[--spectators.client_count];
+}
+
+// Takes the diffs published since the last wake and sends the same buffer to every client
+// that is in sync; clients owed a full frame get one encoded once for all of them
+void broadcast_spectator_frame() // Function definition
+{
+    uint64_t count;
+    ssize_t drained = read(spectators.wake_fd, &count, sizeof(count));
+    (void)drained;
+
+    pthread_mutex_lock(&spectators.lock);
+    ByteWriter taken = spectators.diff;
+    spectators.diff = spectators.broadcast;
+    spectators.diff.length = 0;
+    spectators.diff.ok = true;
+    spectators.broadcast = taken;
+    bool resync = spectators.resync;
+    spectators.resync = false;
+    bool has_frame = spectators.has_frame;
+    bool need_full = false;
+    for (int i = 0; i < spectators.client_count; i++)
+        need_full |= resync || spectators.clients[i].needs_full;
+    if (need_full && has_frame)
+        encode_spectator_full(&spectators.full);
+    pthread_mutex_unlock(&spectators.lock);
+
+    for (int i = spectators.client_count - 1; i >= 0; i--) // Backwards, a drop moves the last client into i
+    {
+        SpectatorClient *client = &spectators.clients[i];
+        bool ok = true;
+        client->needs_full |= resync;
+        if (client->needs_full)
+        {
+            if (!has_frame)
+                continue;
+            // The full frame replaces whatever was still waiting; it starts with ESC, so a
+            // sequence cut short ends there
+            client->backlog.length = client->sent = 0;
+            client->needs_full = false;
+            ok = spectators.full.ok && send_to_spectator(client, spectators.full.data, spectators.full.length) &&
+                 watch_spectator(client);
+        }
+        else if (spectators.broadcast.length > 0)
+        {
+            ok = spectators.broadcast.ok &&
+                 send_to_spectator(client, spectators.broadcast.data, spectators.broadcast.length);
+        }
+        if (!ok)
+            drop_spectator(i);
+    }
+}
+
+// --spectate-check: draws the first frame of a run into a file sink with the server listening
+// on a Unix socket, joins as a loopback spectator and compares the full frame it is sent with
+// what the file sink wrote
+int run_spectator_check() // Function definition
+{
+    static const char socket_path[] = "spectate_check.sock";
+    static const char frame_path[] = "spectate_check.out";
+    char server_spec[64];
+    char sink_spec[64];
+    snprintf(server_spec, sizeof(server_spec), "unix:%s", socket_path);
+    snprintf(sink_spec, sizeof(sink_spec), "file:%s", frame_path);
+    Game *game = create_game(false);
+    if (!game || !open_render_sink(sink_spec) || !start_spectator_server(server_spec))
+    {
+        fprintf(stderr, "Could not set up the spectate check in the current directory\n");
+        close_render_sink();
+        remove(frame_path);
+        destroy_game(game);
+        return 1;
+    }
+    uint64_t seed = pick_run_seed();
+    snprintf(game->player.name, sizeof(game->player.name), "spectator");
+    start_new_run(game, seed);
+    draw_game(game);
+    close_render_sink();
+    size_t length = 0;
+    const unsigned char *expected = map_file(frame_path, &length);
+
+    // The full frame is exactly as long as the file; a second without data means it is not coming
+    ByteWriter received = {NULL, 0, 0, true};
+    struct sockaddr_un address = {0};
+    address.sun_family = AF_UNIX;
+    snprintf(address.sun_path, sizeof(address.sun_path), "%s", socket_path);
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    bool connected = fd >= 0 && connect(fd, (struct sockaddr *)&address, sizeof(address)) == 0;
+    struct pollfd readable = {fd, POLLIN, 0};
+    while (connected && expected && received.length < length && poll(&readable, 1, 1000) == 1)
+    {
+        unsigned char chunk[4096];
+        size_t want = length - received.length < sizeof(chunk) ? length - received.length : sizeof(chunk);
+        ssize_t got = recv(fd, chunk, want, 0);
+        if (got <= 0)
+            break;
+        write_bytes(&received, chunk, got);
+    }
+    bool match = expected && received.ok && received.length == length && memcmp(received.data, expected, length) == 0;
+    printf("spectate_check seed=%llu frame_bytes=%zu received=%zu result=%s\n", (unsigned long long)seed, length,
+           received.length, match ? "match" : "mismatch");
+
+    if (fd >= 0)
+        close(fd);
+    free(received.data);
+    if (expected)
+        unmap_file(expected, length);
+    stop_spectator_server();
+    remove(frame_path);
+    destroy_game(game);
+    return match ? 0 : 1;
+}
+#else
+bool start_spectator_server(const char *spec) // Function definition
+{
+    (void)spec;
+    fprintf(stderr, "Spectating needs epoll, which this platform does not have\n");
+    return false;
+}
+
+void stop_spectator_server() // Function definition
+{
+}
+
+void publish_spectator_frame() // Function definition
+{
+}
+
+int run_spectator_check() // Function definition
+{
+    fprintf(stderr, "Spectating needs epoll, which this platform does not have\n");
+    return 1;
+}
+#endif
+
+// Game flow implementations
+void game_over(Game *game) // Function definition
+{
+    clear_screen();
+#ifdef _WIN32
+    move_cursor(view.width / 2 - 15, view.height / 2 - 1);
+    output_printf("================================");
+    move_cursor(view.width / 2 - 15, view.height / 2);
+    output_printf("        GAME OVER!             ");
+    move_cursor(view.width / 2 - 15, view.height / 2 + 1);
+    output_printf("  Final Score: %-10d      ", game->player.score);
+    move_cursor(view.width / 2 - 15, view.height / 2 + 2);
+    output_printf("================================");
+#else
+    move_cursor(view.width / 2 - 15, view.height / 2 - 1);
+    output_printf("\033[1;31m╔══════════════════════════╗\033[0m");
+    move_cursor(view.width / 2 - 15, view.height / 2);
+    output_printf("\033[1;31m║      GAME OVER!          ║\033[0m");
+    move_cursor(view.width / 2 - 15, view.height / 2 + 1);
+    output_printf("\033[1;31m║ Final Score: %-10d  ║\033[0m", game->player.score);
+    move_cursor(view.width / 2 - 15, view.height / 2 + 2);
+    output_printf("\033[1;31m╚══════════════════════════╝\033[0m");
+#endif
+    int rank = add_to_leaderboard(game);
+    if (rank > 0)
+    {
+        move_cursor(view.width / 2 - 15, view.height / 2 + 3);
+        output_printf("  Rank #%d of %d", rank, leaderboard.count);
+    }
+    end_frame();
+
+    // Clean up save file
+    cancel_autosave();
+    char *save_path = get_save_file_path();
+    remove(save_path);
+
+    wait_for_key(3000); // Any key goes straight to the leaderboard
+}
+
+void get_player_name(Game *game) // Function definition
+{
+    // The terminal stays in raw mode, so the line is edited and echoed here
+    clear_screen();
+    output_printf("Enter your name (max 49 chars): ");
+    end_frame();
+
+    char input[50];
+    int length = 0;
+    while (1)
+    {
+        int key = wait_key();
+        if (key == '\r' || key == '\n')
+            break;
+        if ((key == 127 || key == 8) && length > 0)
+        {
+            length--;
+            output_printf("\b \b");
+        }
+        else if (key < 256 && isprint(key) && length < (int)sizeof(input) - 1)
+        {
+            input[length++] = (char)key;
+            output_printf("%c", key);
+        }
+        end_frame();
+    }
+    input[length] = '\0';
+    output_printf("\n");
+    end_frame();
+
+    if (length > 0)
+    {
+        strncpy(game->player.name, input, sizeof(game->player.name) - 1);
+        game->player.name[sizeof(game->player.name) - 1] = '\0';
+    }
+}
+
+void handle_movement(Game *game, int dx, int dy) // Function definition
+{
+    profile_begin();
+    bool boss_alive = game->boss_count > 0;
+
+    int new_x = game->player.x + dx;
+    int new_y = game->player.y + dy;
+
+    if (is_walkable(game, new_x, new_y))
+    {
+        game->player.x = new_x;
+        game->player.y = new_y;
+        game->flow_stale = true;
+
+        // Only shift world if not in boss room or boss is dead
+        if (dy < 0 && (!boss_alive || !((game->world_offset > 200) && (game->world_offset % 200 == 0))))
+        {
+            update_score(game);
+            if (game->player.y < game->height / 4)
+            {
+                shift_world_down(game);
+            }
+        }
+        // Heading back is allowed down to the first row of the run, but not away from a boss
+        else if (dy > 0 && !boss_alive && game->world_offset > 0 &&
+                 game->player.y >= game->height - game->height / 4)
+        {
+            shift_world_up(game);
+        }
+
+        if (game->realtime)
+        {
+            check_collisions(game); // Enemies move on the next tick
+            profile_end(PHASE_MOVEMENT);
+            return;
+        }
+        move_enemies(game);
+        check_collisions(game);
+
+        if (++game->move_count % 20 == 0)
+        {
+            spawn_enemies(game);
+        }
+    }
+    profile_end(PHASE_MOVEMENT);
+}
+
+// One turn of the game for a key: player move, then enemies, collisions and spawns. In
+// real-time mode a key only moves the player and the world advances on 't' ticks instead.
+void play_turn(Game *game, char ch) // Function definition
+{
+    game->turn_count++;
+    switch (ch)
+    {
+    case 'w':
+        handle_movement(game, 0, -1);
+        break;
+    case 'a':
+        handle_movement(game, -1, 0);
+        break;
+    case 's':
+        handle_movement(game, 0, 1);
+        break;
+    case 'd':
+        handle_movement(game, 1, 0);
+        break;
+    }
+    if (!game->realtime || ch == 't')
+    {
+        // Process enemy movement and collisions after player moves
+        move_enemies(game);
+        check_collisions(game);
+
+        // Spawn new enemies periodically
+        if (++game->move_count % 20 == 0)
+        {
+            spawn_enemies(game);
+        }
+    }
+
+    // Only a turn that ends at 0 hp is a death; a level up later in the turn heals a fatal hit
+    if (game->player.hp <= 0 && !game->death_cause)
+    {
+        game->death_cause = game->hit_by_boss ? "boss" : "enemy";
+        game->death_turn = game->turn_count;
+    }
+}
+
+// Handles one key during play: p saves, q quits to the menu, anything else is a turn
+GameState apply_game_key(Game *game, ReplayRecorder *recorder, int key) // Function definition
+{
+    char ch = tolower(key_to_char(key));
+
+    if (ch == 'p')
+    { // Save game
+        if (save_game(game))
+        {
+            display_message("Game saved!", MSG_LINE_1, true);
+            return MAIN_MENU;
+        }
+        post_message(game, MSG_LINE_1, COLOR_BRIGHT_RED, ">>> Save failed! <<<", 2.0, 0);
+    }
+    else if (ch == 'q') // Function definition
+    {                   // Quit to menu
+        return MAIN_MENU;
+    }
+    else if (ch != 't') // Ticks come from the scheduler only
+    {                   // Handle movement
+        play_turn(game, ch);
+        record_turn(recorder, game, ch);
+    }
+    return IN_GAME;
+}
+
+void game_loop() // Function definition
+{
+    GameState state = MAIN_MENU;
+    // Different states of the game (menu, playing, game over, etc.)
+    bool has_save = save_file_exists();
+    ReplayRecorder recorder = {NULL, keyframe_interval_option, 0};
+    TickClock clock;
+    Game *game = create_game(false);
+    if (!game)
+        return;
+    game->realtime = realtime_tick_rate > 0;
+
+    show_welcome_screen();
+    load_leaderboard();
+
+    while (1)
+    {
+        // Always check for save file when returning to menu
+        if (state == MAIN_MENU)
+        {
+            has_save = save_file_exists();
+        }
+
+        switch (state)
+        {
+        case MAIN_MENU:
+        {
+            int choice = show_main_menu(has_save);
+            if (choice == 0 && has_save)
+            { // Continue
+                if (load_game(game))
+                {
+                    if (record_enabled)
+                        start_recording(&recorder, get_replay_path(), game); // Starting keyframe covers the loaded state
+                    start_tick_clock(&clock, now_seconds());
+                    clear_messages();
+                    state = IN_GAME;
+                }
+            }
+            else if (choice == 1) // Function definition
+            {                     // New Game
+                // Delete any existing save file when starting new game
+                cancel_autosave();
+                char *save_path = get_save_file_path();
+                remove(save_path);
+
+                get_player_name(game);
+                start_new_run(game, pick_run_seed());
+                if (record_enabled)
+                    start_recording(&recorder, get_replay_path(), game);
+                start_tick_clock(&clock, now_seconds());
+                clear_messages();
+                state = IN_GAME;
+            }
+            else if (choice == 2) // Function definition
+            {                     // Leaderboard
+                state = LEADERBOARD;
+            }
+            else
+            { // Exit
+                destroy_game(game);
+                free_leaderboard(&leaderboard);
+                return;
+            }
+            break;
+        }
+
+        case IN_GAME:
+        {
+            // Check for death before processing anything else
+            if (game->player.hp <= 0)
+            {
+                state = GAME_OVER;
+                break;
+            }
+
+            if (game->realtime)
+            {
+                state = play_realtime_frame(game, &recorder, &clock);
+            }
+            else
+            {
+                draw_game(game);
+
+                // Handle every key that is already waiting before drawing the next frame. Without
+                // one, wake up when a timed message runs out so it goes without waiting for a key.
+                int key;
+                if (!poll_key(&key) && !(pump_input(message_wait_ms()) && poll_key(&key)))
+                    break;
+                do
+                {
+                    state = apply_game_key(game, &recorder, key);
+                } while (state == IN_GAME && game->player.hp > 0 && poll_key(&key));
+            }
+
+            // Push recorded turns out every frame so a crash or kill still leaves the replay
+            if (state != IN_GAME || game->player.hp <= 0)
+            {
+                stop_recording(&recorder);
+            }
+            else
+            {
+                if (recorder.file)
+                    fflush(recorder.file);
+                maybe_autosave(game);
+            }
+            break;
+        }
+
+        case GAME_OVER:
+        {
+            game_over(game);
+            state = LEADERBOARD;
+            break;
+        }
+
+        case LEADERBOARD:
+        {
+            show_leaderboard();
+            state = MAIN_MENU;
+            break;
+        }
+        }
+    }
+}
+
+// dbugging
+//  void debug_game_state() {
+//      printf("\nDEBUG: Game State\n");
+//      printf("Player: %s (HP: %d/%d)\n", player.name, player.hp, player.max_hp);
+//      printf("Score: %d, Level: %d\n", player.score, player.level);
+//      printf("Save exists: %s\n", save_file_exists() ? "YES" : "NO");
+
+//     FILE *lb = fopen(get_leaderboard_path(), "r");
+//     printf("Leaderboard exists: %s\n", lb ? "YES" : "NO");
+//     if (lb) fclose(lb);
+// }
+// Headless implementations
+double now_seconds() // Function definition
+{
+#ifdef _WIN32
+    LARGE_INTEGER frequency, counter;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+    return (double)counter.QuadPart / frequency.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+#endif
+}
+
+// Fresh player, map and enemies (keeps player.name); the seed fixes every random stream
+void start_new_run(Game *game, uint64_t seed) // Function definition
+{
+    seed_game_random(game, seed);
+    game->world_offset = 0; // Before init_map(), which decides boss rooms from it
+    game->furthest_offset = 0;
+    init_player(game);
+    init_map(game);
+    reset_enemies(game);
+    game->move_count = 0;
+    game->turn_count = 0;
+    game->death_turn = -1;
+    game->death_cause = NULL;
+    spawn_enemies(game);
+}
+
+// Random policy: mostly pushes forward so runs actually travel
+char random_policy_key(Game *game) // Function definition
+{
+    int r = rng_range(&game->rng.policy, 100);
+    if (r < 55)
+        return 'w';
+    if (r < 70)
+        return 'a';
+    if (r < 85)
+        return 'd';
+    return 's';
+}
+
+// Next key from a script or stdin; whitespace and #-comments are skipped, EOF ends the run
+int read_script_key(FILE *input) // Function definition
+{
+    int c;
+    while ((c = fgetc(input)) != EOF)
+    {
+        if (c == '#')
+        {
+            while ((c = fgetc(input)) != EOF && c != '\n')
+                ;
+            continue;
+        }
+        if (!isspace(c))
+            return tolower(c);
+    }
+    return EOF;
+}
+
+// Plays one game with no terminal I/O and reports simulation throughput
+int run_headless(const HeadlessConfig *config) // Function definition
+{
+    FILE *input = NULL;
+    if (config->input == INPUT_SCRIPT)
+    {
+        input = fopen(config->script_path, "r");
+        if (!input)
+        {
+            fprintf(stderr, "Could not open script '%s'\n", config->script_path);
+            return 1;
+        }
+    }
+    else if (config->input == INPUT_STDIN)
+    {
+        input = stdin;
+    }
+
+    Game *game = create_game(true);
+    if (!game)
+    {
+        if (input && input != stdin)
+            fclose(input);
+        return 1;
+    }
+    snprintf(game->player.name, sizeof(game->player.name), "headless");
+    game->realtime = realtime_tick_rate > 0;
+    start_new_run(game, pick_run_seed());
+    ReplayRecorder recorder = {NULL, keyframe_interval_option, 0};
+    if (autosave_option_set)
+        start_autosave();
+    if (record_path && record_enabled && !start_recording(&recorder, record_path, game))
+        fprintf(stderr, "Could not record to '%s'\n", record_path);
+
+    const char *end_reason = "turn limit";
+    double start = now_seconds();
+    TickClock clock;
+    start_tick_clock(&clock, start);
+    while (game->turn_count < config->max_turns)
+    {
+        // Real time: the input plays one key per tick and frames are drawn into the sink
+        if (game->realtime)
+        {
+            double pass_start = now_seconds();
+            if (frame_due(&clock, pass_start))
+                draw_realtime_frame(game, &clock, pass_start);
+            if (!tick_due(&clock, now_seconds()))
+            {
+                sleep_seconds(clock_wait(&clock, now_seconds()));
+                continue;
+            }
+        }
+
+        int key = input ? read_script_key(input) : random_policy_key(game);
+        if (key == EOF)
+        {
+            end_reason = "input exhausted";
+            break;
+        }
+
+        play_turn(game, (char)key);
+        record_turn(&recorder, game, (char)key);
+        if (game->realtime && game->player.hp > 0)
+            run_world_tick(game, &recorder);
+        maybe_autosave(game);
+        if (game->player.hp <= 0)
+        {
+            end_reason = "died";
+            break;
+        }
+    }
+    double elapsed = now_seconds() - start;
+    stop_recording(&recorder);
+    stop_autosave();
+
+    if (input && input != stdin)
+        fclose(input);
+
+    report_run(game, end_reason, game->turn_count, elapsed);
+    if (report_chunk_stats)
+        report_chunk_store(stderr, game->history);
+    if (report_tick_stats && game->realtime)
+        report_realtime(stderr);
+    destroy_game(game);
+    return 0;
+}
+
+// Final state of a headless or replayed run; turns is how many were simulated in elapsed
+void report_run(const Game *game, const char *end_reason, long turns, double elapsed) // Function definition
+{
+    printf("seed=%llu\n", (unsigned long long)game->rng.seed);
+    printf("turns=%ld elapsed=%.6fs turns_per_sec=%.0f\n",
+           game->turn_count, elapsed, elapsed > 0 ? turns / elapsed : 0.0);
+    printf("distance=%d level=%d hp=%d/%d enemies=%d\n",
+           game->player.score, game->player.level, game->player.hp, game->player.max_hp, game->enemies.count);
+    if (game->player.hp <= 0 && game->death_cause)
+        printf("result=%s cause=%s death_turn=%ld\n", end_reason, game->death_cause, game->death_turn);
+    else
+        printf("result=%s\n", end_reason);
+}
+
+// Real-time implementations
+void start_tick_clock(TickClock *clock, double now) // Function definition
+{
+    clock->tick_length = 1.0 / realtime_tick_rate;
+    clock->frame_length = 1.0 / realtime_frame_rate;
+    clock->next_tick = now + clock->tick_length;
+    clock->next_frame = now;
+}
+
+// True once per tick that is due at now. After a stall more than MAX_TICK_CATCHUP ticks
+// behind, the rest are dropped so the loop catches up instead of spiralling.
+bool tick_due(TickClock *clock, double now) // Function definition
+{
+    if (now < clock->next_tick)
+        return false;
+    long behind = (long)((now - clock->next_tick) / clock->tick_length);
+    if (behind > MAX_TICK_CATCHUP)
+    {
+        realtime_stats.dropped_ticks += behind - MAX_TICK_CATCHUP;
+        clock->next_tick += (behind - MAX_TICK_CATCHUP) * clock->tick_length;
+    }
+    record_timing(&realtime_stats.lateness, now - clock->next_tick);
+    clock->next_tick += clock->tick_length;
+    return true;
+}
+
+// Frames are never made up: a late frame is drawn once and the next one is a full frame later
+bool frame_due(TickClock *clock, double now) // Function definition
+{
+    if (now < clock->next_frame)
+        return false;
+    clock->next_frame += clock->frame_length;
+    if (clock->next_frame <= now)
+        clock->next_frame = now + clock->frame_length;
+    return true;
+}
+
+// Seconds until the next tick or frame is due
+double clock_wait(const TickClock *clock, double now) // Function definition
+{
+    double next = clock->next_tick < clock->next_frame ? clock->next_tick : clock->next_frame;
+    return next > now ? next - now : 0;
+}
+
+void run_world_tick(Game *game, ReplayRecorder *recorder) // Function definition
+{
+    double start = now_seconds();
+    play_turn(game, 't');
+    record_timing(&realtime_stats.tick, now_seconds() - start);
+    record_turn(recorder, game, 't');
+}
+
+void draw_realtime_frame(Game *game, const TickClock *clock, double pass_start) // Function definition
+{
+    double start = now_seconds();
+    draw_game(game);
+    double end = now_seconds();
+    record_timing(&realtime_stats.frame, end - start);
+    if (end - pass_start > clock->frame_length)
+        realtime_stats.slow_frames++;
+}
 
-    while (1)
+// One pass of the real-time loop: keys that are waiting, ticks that are due, a frame when one is
+// due, then a wait for whichever comes next. Input cuts the wait short.
+GameState play_realtime_frame(Game *game, ReplayRecorder *recorder, TickClock *clock) // Function definition
+{
+    double pass_start = now_seconds();
+    GameState state = IN_GAME;
+    int key;
+    while (state == IN_GAME && game->player.hp > 0 && poll_key(&key))
     {
-        clear_screen();
+        state = apply_game_key(game, recorder, key);
+    }
+    while (state == IN_GAME && game->player.hp > 0 && tick_due(clock, now_seconds()))
+    {
+        run_world_tick(game, recorder);
+    }
+    if (state != IN_GAME)
+        return state;
+    if (frame_due(clock, now_seconds()))
+        draw_realtime_frame(game, clock, pass_start);
+    if (game->player.hp > 0)
+        pump_input((int)(clock_wait(clock, now_seconds()) * 1000.0 + 0.999)); // Rounded up, poll() counts milliseconds
+    return state;
+}
 
-        // Header with color
-        move_cursor(0, 0);
-        printf("\033[1;36m=== LEADERBOARD ===\033[0m"); // Cyan header
-        move_cursor(0, 1);
-        printf("\033[1;94mRank  Name           Level  Distance\033[0m"); // Yellow column headers
+void record_timing(TimingHistogram *histogram, double seconds) // Function definition
+{
+    if (seconds < 0)
+        seconds = 0;
+    long bucket = (long)(seconds / TIMING_BUCKET_SECONDS);
+    histogram->buckets[bucket < TIMING_BUCKETS ? bucket : TIMING_BUCKETS - 1]++;
+    histogram->count++;
+    histogram->total += seconds;
+    if (seconds > histogram->max)
+        histogram->max = seconds;
+}
 
-        // Leaderboard entries
-        for (int i = 0; i < leaderboard_size; i++)
-        {
-            move_cursor(0, 2 + i);
+// Upper edge of the bucket holding the given fraction of samples, in seconds
+double timing_percentile(const TimingHistogram *histogram, double fraction) // Function definition
+{
+    unsigned long long target = (unsigned long long)(fraction * histogram->count);
+    unsigned long long seen = 0;
+    for (int i = 0; i < TIMING_BUCKETS; i++)
+    {
+        seen += histogram->buckets[i];
+        if (seen > target)
+            return (i + 1) * TIMING_BUCKET_SECONDS < histogram->max ? (i + 1) * TIMING_BUCKET_SECONDS : histogram->max;
+    }
+    return histogram->max;
+}
 
-            // Apply medal-based color styling
-            if (i == 0)
-                printf("\033[1;93m"); // Gold (bright yellow)
-            else if (i == 1)          // Function definition
-                printf("\033[1;97m"); // Silver (bright white)
-            else if (i == 2)          // Function definition
-                printf("\033[1;30m"); // Bronze (regular yellow)
-            else
-                printf("\033[0;250m"); // Regular white/gray
+void report_realtime(FILE *stream) // Function definition
+{
+    const TimingHistogram *parts[] = {&realtime_stats.tick, &realtime_stats.frame, &realtime_stats.lateness};
+    const char *names[] = {"tick", "frame", "tick lateness"};
+    fprintf(stream, "realtime: %.0f ticks/s, %.0f frames/s budget %.2fms\n",
+            realtime_tick_rate, realtime_frame_rate, 1000.0 / realtime_frame_rate);
+    for (int i = 0; i < 3; i++)
+    {
+        const TimingHistogram *h = parts[i];
+        fprintf(stream, "realtime: %s n=%llu avg=%.3fms p50=%.3fms p99=%.3fms max=%.3fms\n", names[i], h->count,
+                h->count ? h->total / h->count * 1e3 : 0.0, timing_percentile(h, 0.50) * 1e3,
+                timing_percentile(h, 0.99) * 1e3, h->max * 1e3);
+    }
+    fprintf(stream, "realtime: slow frames=%llu dropped ticks=%llu\n", realtime_stats.slow_frames,
+            realtime_stats.dropped_ticks);
+}
 
-            printf("%2d.   %-12s   %3d     %5d\033[0m",
-                   i + 1,
-                   leaderboard[i].name,
-                   leaderboard[i].level,
-                   leaderboard[i].distance);
-        }
+// Profiler implementations
+// Starts timing a phase; with profiling off this is a single test
+void profile_begin() // Function definition
+{
+    if (!profiling)
+        return;
+    if (profile_depth < PROFILE_MAX_DEPTH)
+    {
+        profile_stack[profile_depth].start = now_seconds();
+        profile_stack[profile_depth].nested = 0;
+    }
+    profile_depth++;
+}
 
-        // Menu options - positioned below with colors
-        int menu_pos = 3 + leaderboard_size;
-        move_cursor(0, menu_pos);
-        printf("\n"); // Spacer
+// Ends the innermost phase, recording its own time and charging its whole time to the phase around it
+void profile_end(ProfilePhase phase) // Function definition
+{
+    if (!profiling || profile_depth == 0)
+        return;
+    if (--profile_depth >= PROFILE_MAX_DEPTH)
+        return;
+    ProfileFrame *frame = &profile_stack[profile_depth];
+    double elapsed = now_seconds() - frame->start;
+    if (profile_depth > 0)
+        profile_stack[profile_depth - 1].nested += elapsed;
+    double own = elapsed - frame->nested;
+    record_latency(&profile_phases[phase], own > 0 ? (uint64_t)(own * 1e9 + 0.5) : 0);
+}
 
-        // Return to Menu option
-        move_cursor(0, menu_pos + 1);
-        if (selected == 0)
+int latency_bucket(uint64_t nanoseconds) // Function definition
+{
+    if (nanoseconds < (1u << PROFILE_SUB_BITS))
+        return (int)nanoseconds;
+    int exponent = 63 - __builtin_clzll(nanoseconds);
+    int shift = exponent - PROFILE_SUB_BITS;
+    return ((shift + 1) << PROFILE_SUB_BITS) + (int)((nanoseconds >> shift) - (1u << PROFILE_SUB_BITS));
+}
+
+// First value past the bucket
+uint64_t latency_bucket_limit(int bucket) // Function definition
+{
+    int group = bucket >> PROFILE_SUB_BITS;
+    if (group == 0)
+        return (uint64_t)bucket + 1;
+    uint64_t low = ((1ull << PROFILE_SUB_BITS) + (bucket & ((1 << PROFILE_SUB_BITS) - 1))) << (group - 1);
+    return low + (1ull << (group - 1));
+}
+
+void record_latency(LatencyHistogram *histogram, uint64_t nanoseconds) // Function definition
+{
+    histogram->buckets[latency_bucket(nanoseconds)]++;
+    histogram->count++;
+    histogram->total += nanoseconds;
+    if (nanoseconds > histogram->max)
+        histogram->max = nanoseconds;
+}
+
+// Upper edge of the bucket holding the given fraction of samples, never past the maximum
+uint64_t latency_percentile(const LatencyHistogram *histogram, double fraction) // Function definition
+{
+    unsigned long long target = (unsigned long long)(fraction * histogram->count);
+    unsigned long long seen = 0;
+    for (int i = 0; i < PROFILE_BUCKETS; i++)
+    {
+        seen += histogram->buckets[i];
+        if (seen > target)
+            return latency_bucket_limit(i) - 1 < histogram->max ? latency_bucket_limit(i) - 1 : histogram->max;
+    }
+    return histogram->max;
+}
+
+// Registered with atexit when profiling, so every way out of the game reports
+void report_profile() // Function definition
+{
+    static const char *names[PHASE_COUNT] = {"handle_movement", "move_enemies", "check_collisions", "spawn_enemies",
+                                             "shift_world", "draw_game", "file I/O"};
+    uint64_t total = 0;
+    for (int i = 0; i < PHASE_COUNT; i++)
+        total += profile_phases[i].total;
+
+    fprintf(stderr, "profile: own time per call, nested phases excluded (us)\n");
+    fprintf(stderr, "profile: %-16s %10s %10s %6s %9s %9s %9s %9s\n", "phase", "calls", "total ms", "share", "p50",
+            "p90", "p99", "max");
+    for (int i = 0; i < PHASE_COUNT; i++)
+    {
+        const LatencyHistogram *h = &profile_phases[i];
+        fprintf(stderr, "profile: %-16s %10llu %10.3f %5.1f%% %9.3f %9.3f %9.3f %9.3f\n", names[i], h->count,
+                h->total / 1e6, total ? 100.0 * h->total / total : 0.0, latency_percentile(h, 0.50) / 1e3,
+                latency_percentile(h, 0.90) / 1e3, latency_percentile(h, 0.99) / 1e3, h->max / 1e3);
+    }
+}
+
+// Simulator implementations
+// splitmix64 finalizer: spreads consecutive game numbers into unrelated seeds
+uint64_t mix_seed(uint64_t value) // Function definition
+{
+    value += 0x9E3779B97F4A7C15ULL;
+    value = (value ^ (value >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    value = (value ^ (value >> 27)) * 0x94D049BB133111EBULL;
+    return value ^ (value >> 31);
+}
+
+// Applies one "name=value" balance override
+bool set_balance_option(Balance *balance, const char *spec) // Function definition
+{
+    const char *eq = strchr(spec, '=');
+    if (!eq)
+        return false;
+    size_t length = eq - spec;
+    double value = atof(eq + 1);
+
+    struct
+    {
+        const char *name;
+        int *int_field;
+        float *float_field;
+        double *double_field;
+    } fields[] = {
+        {"progress_rate", NULL, &balance->progress_rate, NULL},
+        {"boss_hp", &balance->boss_hp, NULL, NULL},
+        {"boss_hp_rate", &balance->boss_hp_rate, NULL, NULL},
+        {"boss_strength", &balance->boss_strength, NULL, NULL},
+        {"boss_strength_rate", &balance->boss_strength_rate, NULL, NULL},
+        {"boss_xp", &balance->boss_xp, NULL, NULL},
+        {"boss_xp_rate", &balance->boss_xp_rate, NULL, NULL},
+        {"xp_growth", NULL, NULL, &balance->xp_growth}};
+
+    for (size_t i = 0; i < sizeof(fields) / sizeof(fields[0]); i++)
+    {
+        if (strlen(fields[i].name) != length || strncmp(fields[i].name, spec, length) != 0)
+            continue;
+        if (fields[i].int_field)
+        {
+            if ((int)value <= 0 && strstr(fields[i].name, "_rate"))
+                return false; // Rates are divisors
+            *fields[i].int_field = (int)value;
+        }
+        else if (fields[i].float_field)
         {
-            printf("\033[1;92m> "); // Bright green for selection
+            if (value <= 0)
+                return false;
+            *fields[i].float_field = (float)value;
         }
         else
         {
-            printf("\033[0;37m  "); // Normal white
+            *fields[i].double_field = value;
         }
-        printf("Return to Menu\033[0m");
+        return true;
+    }
+    return false;
+}
 
-        // Exit Game option
-        move_cursor(0, menu_pos + 2);
-        if (selected == 1)
+// Worker body: one Game reused for every run, stats kept private to the thread
+void run_sim_games(SimWorker *worker) // Function definition
+{
+    Game *game = create_game(true);
+    if (!game)
+        return;
+    SimStats *stats = &worker->stats;
+
+    for (long i = worker->first_game; i < worker->game_count; i += worker->stride)
+    {
+        start_new_run(game, mix_seed(worker->base_seed + (uint64_t)i));
+        while (game->player.hp > 0 && game->turn_count < worker->max_turns)
         {
-            printf("\033[1;32m> ");
+            play_turn(game, random_policy_key(game));
         }
+
+        int distance = game->player.score;
+        int level = game->player.level;
+        stats->games++;
+        stats->turns += game->turn_count;
+        stats->distance_sum += distance;
+        stats->level_sum += level;
+        if (distance > stats->max_distance)
+            stats->max_distance = distance;
+        stats->distance_counts[distance < SIM_DISTANCE_BUCKETS ? distance : SIM_DISTANCE_BUCKETS - 1]++;
+        stats->level_counts[level < SIM_MAX_LEVEL ? level : SIM_MAX_LEVEL]++;
+
+        if (game->player.hp > 0)
+            stats->survived++;
+        else if (game->death_cause && strcmp(game->death_cause, "boss") == 0)
+            stats->deaths_by_boss++;
         else
+            stats->deaths_by_enemy++;
+    }
+    destroy_game(game);
+}
+
+#ifdef _WIN32
+DWORD WINAPI sim_thread_main(LPVOID arg) // Function definition
+{
+    run_sim_games((SimWorker *)arg);
+    return 0;
+}
+#else
+void *sim_thread_main(void *arg) // Function definition
+{
+    run_sim_games((SimWorker *)arg);
+    return NULL;
+}
+#endif
+
+int default_thread_count() // Function definition
+{
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return (int)info.dwNumberOfProcessors;
+#else
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? (int)count : 1;
+#endif
+}
+
+// Smallest distance with at least fraction of all games at or below it
+int distance_percentile(const SimStats *stats, double fraction) // Function definition
+{
+    unsigned long long target = (unsigned long long)(fraction * stats->games);
+    if (target == 0)
+        target = 1;
+    unsigned long long seen = 0;
+    for (int d = 0; d < SIM_DISTANCE_BUCKETS; d++)
+    {
+        seen += stats->distance_counts[d];
+        if (seen >= target)
+            return d;
+    }
+    return SIM_DISTANCE_BUCKETS - 1;
+}
+
+// Plays many headless games across threads with the random policy and prints outcome distributions
+int run_simulation(long games, int threads, long max_turns) // Function definition
+{
+    if (threads <= 0)
+        threads = default_thread_count();
+    if (threads > SIM_MAX_THREADS)
+        threads = SIM_MAX_THREADS;
+    if (threads > games)
+        threads = games > 0 ? (int)games : 1;
+
+    SimWorker *workers = calloc(threads, sizeof(SimWorker));
+    if (!workers)
+        return 1;
+    uint64_t base_seed = pick_run_seed();
+    for (int t = 0; t < threads; t++)
+    {
+        workers[t] = (SimWorker){t, threads, games, max_turns, base_seed, {0}};
+    }
+
+    double start = now_seconds();
+#ifdef _WIN32
+    HANDLE handles[SIM_MAX_THREADS];
+    for (int t = 0; t < threads; t++)
+    {
+        handles[t] = CreateThread(NULL, 0, sim_thread_main, &workers[t], 0, NULL);
+    }
+    for (int t = 0; t < threads; t++)
+    {
+        if (handles[t])
         {
-            printf("\033[0;37m  ");
+            WaitForSingleObject(handles[t], INFINITE);
+            CloseHandle(handles[t]);
         }
-        printf("Exit Game\033[0m");
-
-        // Input handling
-        char ch = getch();
-        switch (tolower(ch))
+        else
         {
-        case 'w':
-            selected = (selected - 1 + 2) % 2;
-            break;
-        case 's':
-            selected = (selected + 1) % 2;
-            break;
-        case '\r': // Enter
-        case '\n':
-            if (selected == 0)
-            {
-                printf("\033[0m"); // Reset colors before returning
-                return;
-            }
-            else
-            {
-                exit(0);
-            }
-            break;
+            run_sim_games(&workers[t]);
         }
+    }
+#else
+    pthread_t handles[SIM_MAX_THREADS];
+    bool started[SIM_MAX_THREADS];
+    for (int t = 0; t < threads; t++)
+    {
+        started[t] = pthread_create(&handles[t], NULL, sim_thread_main, &workers[t]) == 0;
+    }
+    for (int t = 0; t < threads; t++)
+    {
+        if (started[t])
+            pthread_join(handles[t], NULL);
+        else
+            run_sim_games(&workers[t]); // Could not start a thread, do its share here
+    }
+#endif
+    double elapsed = now_seconds() - start;
 
-        fflush(stdout); // Ensure all output is displayed
+    // Merge the per-thread stats
+    SimStats *total = calloc(1, sizeof(SimStats));
+    if (!total)
+    {
+        free(workers);
+        return 1;
     }
+    for (int t = 0; t < threads; t++)
+    {
+        const SimStats *stats = &workers[t].stats;
+        total->games += stats->games;
+        total->turns += stats->turns;
+        total->deaths_by_enemy += stats->deaths_by_enemy;
+        total->deaths_by_boss += stats->deaths_by_boss;
+        total->survived += stats->survived;
+        total->distance_sum += stats->distance_sum;
+        total->level_sum += stats->level_sum;
+        if (stats->max_distance > total->max_distance)
+            total->max_distance = stats->max_distance;
+        for (int d = 0; d < SIM_DISTANCE_BUCKETS; d++)
+            total->distance_counts[d] += stats->distance_counts[d];
+        for (int l = 0; l <= SIM_MAX_LEVEL; l++)
+            total->level_counts[l] += stats->level_counts[l];
+    }
+    free(workers);
+
+    double count = total->games ? (double)total->games : 1.0;
+    printf("games=%llu threads=%d seed=%llu elapsed=%.3fs games_per_sec=%.0f turns_per_sec=%.0f\n",
+           total->games, threads, (unsigned long long)base_seed, elapsed,
+           elapsed > 0 ? total->games / elapsed : 0.0, elapsed > 0 ? total->turns / elapsed : 0.0);
+    printf("distance mean=%.1f p10=%d p50=%d p90=%d p99=%d max=%d\n",
+           total->distance_sum / count,
+           distance_percentile(total, 0.10), distance_percentile(total, 0.50),
+           distance_percentile(total, 0.90), distance_percentile(total, 0.99), total->max_distance);
+    printf("level mean=%.2f\n", total->level_sum / count);
+    for (int l = 1; l <= SIM_MAX_LEVEL; l++)
+    {
+        if (total->level_counts[l])
+            printf("  level %2d%s %6.2f%%\n", l, l == SIM_MAX_LEVEL ? "+" : " ", 100.0 * total->level_counts[l] / count);
+    }
+    printf("death enemy=%.2f%% boss=%.2f%% survived=%.2f%%\n",
+           100.0 * total->deaths_by_enemy / count, 100.0 * total->deaths_by_boss / count,
+           100.0 * total->survived / count);
+    free(total);
+    return 0;
 }
-// Save/load implementations
 
-bool save_game(const GameData *data)
-{ // Function definition
-    if (data->player.hp <= 0)
+// Benchmark implementations
+// Headless game of the given size, started from BENCH_SEED and filled with up to enemies enemies
+// (small maps may run out of spawn cells first). The cap is left a wave above the fill so
+// spawn_enemies() still has room to place one.
+Game *create_bench_game(int width, int height, int enemies) // Function definition
+{
+    world_option = (WorldSize){width, height, enemies};
+    Game *game = create_game(true);
+    if (!game)
+        return NULL;
+    start_new_run(game, BENCH_SEED);
+    while (game->enemies.count < enemies && spawn_enemies(game) > 0)
+        ;
+    game->max_enemies = enemies + 8;
+    return game;
+}
+
+// Entries with distinct names and shuffled distances, so they are not stored in rank order
+void fill_bench_leaderboard(Leaderboard *board, int entries) // Function definition
+{
+    Rng rng;
+    rng_seed(&rng, BENCH_SEED, 7);
+    rng_seed(&board->priorities, BENCH_SEED, 6);
+    for (int i = 0; i < entries; i++)
     {
-        // printf("DEBUG: Not saving - player is dead\n");
-        return false;
+        char name[50];
+        snprintf(name, sizeof(name), "bench%06d", i);
+        upsert_leaderboard(board, name, 1 + rng_range(&rng, 40), rng_range(&rng, 1000000));
     }
+}
 
-    char *path = get_save_file_path();
-    // printf("DEBUG: Attempting to save to: %s\n", path);
+void bench_generate_new_row(BenchContext *context) // Function definition
+{
+    generate_new_row(context->game, (int)(context->step % context->game->height));
+}
 
-    FILE *file = fopen(path, "wb");
-    if (!file)
+// Keeps the player on the map; enemies scroll off as they would in play and are not replaced
+void bench_shift_world_down(BenchContext *context) // Function definition
+{
+    context->game->player.y = context->game->height / 2;
+    shift_world_down(context->game);
+}
+
+// The player moves every turn in play, so every call also rebuilds the flow field
+void bench_move_enemies(BenchContext *context) // Function definition
+{
+    context->game->flow_stale = true;
+    move_enemies(context->game);
+}
+
+void bench_check_collisions(BenchContext *context) // Function definition
+{
+    check_collisions(context->game);
+}
+
+// Spawns a wave and removes it again, so every call sees the same number of enemies
+void bench_spawn_enemies(BenchContext *context) // Function definition
+{
+    Game *game = context->game;
+    int before = game->enemies.count;
+    spawn_enemies(game);
+    while (game->enemies.count > before)
+        despawn_enemy(game, game->enemies.count - 1);
+}
+
+// Draws to the null sink; after the first frame only the diff against the last one is sent
+void bench_draw_game(BenchContext *context) // Function definition
+{
+    draw_game(context->game);
+}
+
+// Encode and decode without touching the disk
+void bench_save_memory(BenchContext *context) // Function definition
+{
+    context->payload.length = 0;
+    context->payload.ok = true;
+    encode_save(&context->payload, context->game);
+    ByteReader reader = {context->payload.data, context->payload.length, 0, context->payload.ok};
+    decode_save(&reader, context->copy);
+}
+
+// The full save_game() and load_game() path: temp file, fsync, rename, then a mapped read
+void bench_save_file(BenchContext *context) // Function definition
+{
+    context->payload.length = 0;
+    context->payload.ok = true;
+    encode_save(&context->payload, context->game);
+    write_save_file(BENCH_SAVE_PATH, &context->payload);
+
+    size_t length;
+    const unsigned char *data = map_file(BENCH_SAVE_PATH, &length);
+    if (!data)
+        return;
+    ByteReader payload;
+    if (check_save_header(data, length, &payload))
+        decode_save(&payload, context->copy);
+    unmap_file(data, length);
+}
+
+void bench_leaderboard_load(BenchContext *context) // Function definition
+{
+    clear_leaderboard(&context->board);
+    read_leaderboard_file(&context->board, BENCH_LEADERBOARD_PATH);
+}
+
+// A player beating their best: the entry is unlinked and inserted at its new rank
+void bench_leaderboard_update(BenchContext *context) // Function definition
+{
+    Leaderboard *board = &context->board;
+    LeaderboardEntry *entry = &board->entries[context->step % board->count];
+    upsert_leaderboard(board, entry->name, entry->level, entry->distance + 1);
+}
+
+// Ranks entries that are out of order, one treap insert each
+void bench_leaderboard_sort(BenchContext *context) // Function definition
+{
+    context->board.root = build_ranks(&context->board);
+}
+
+// Doubles the batch until it takes BENCH_BATCH_SECONDS (which also warms up), then times
+// BENCH_BATCHES batches of that size
+BenchResult time_bench_kernel(const BenchKernel *kernel, BenchContext *context) // Function definition
+{
+    long batch = 1;
+    while (1)
     {
-        // printf("DEBUG: Failed to open save file\n");
-        // perror("Error");
-        return false;
+        double start = now_seconds();
+        for (long i = 0; i < batch; i++, context->step++)
+            kernel->run(context);
+        if (now_seconds() - start >= BENCH_BATCH_SECONDS)
+            break;
+        batch *= 2;
     }
 
-    bool success = fwrite(data, sizeof(GameData), 1, file) == 1;
-    fclose(file);
+    double samples[BENCH_BATCHES];
+    for (int b = 0; b < BENCH_BATCHES; b++)
+    {
+        double start = now_seconds();
+        for (long i = 0; i < batch; i++, context->step++)
+            kernel->run(context);
+        double sample = (now_seconds() - start) * 1e9 / batch;
+
+        int j = b;
+        for (; j > 0 && samples[j - 1] > sample; j--)
+            samples[j] = samples[j - 1];
+        samples[j] = sample;
+    }
+    return (BenchResult){kernel->name, (long long)batch * BENCH_BATCHES, samples[BENCH_BATCHES / 2], samples[0]};
+}
+
+// One JSON result object, and a readable line on stderr
+void report_bench_result(FILE *out, bool *first, const BenchResult *result, const char *params) // Function definition
+{
+    fprintf(out, "%s\n    {\"kernel\": \"%s\", %s, \"iterations\": %lld, \"ns_per_op\": %.1f, \"min_ns_per_op\": %.1f}",
+            *first ? "" : ",", result->kernel, params, result->iterations, result->median, result->fastest);
+    *first = false;
+    fprintf(stderr, "bench: %-20s %-48s %12.1f ns/op\n", result->kernel, params, result->median);
+}
+
+// Times every kernel at each map size and enemy count (leaderboard kernels at each board size)
+// and writes the results as JSON to path, or stdout for "-"
+int run_benchmarks(const char *path) // Function definition
+{
+    static const int sizes[][2] = {{DEFAULT_MAP_WIDTH, DEFAULT_MAP_HEIGHT}, {160, 48}, {640, 192}};
+    static const int enemy_counts[] = {DEFAULT_MAX_ENEMIES, 100, 400};
+    static const int board_sizes[] = {100, 10000, 100000};
+    static const BenchKernel game_kernels[] = {
+        {"generate_new_row", bench_generate_new_row},
+        {"shift_world_down", bench_shift_world_down},
+        {"move_enemies", bench_move_enemies},
+        {"check_collisions", bench_check_collisions},
+        {"spawn_enemies", bench_spawn_enemies},
+        {"draw_game", bench_draw_game},
+        {"save_load_memory", bench_save_memory},
+        {"save_load_file", bench_save_file}};
+    static const BenchKernel board_kernels[] = {
+        {"leaderboard_load", bench_leaderboard_load},
+        {"leaderboard_update", bench_leaderboard_update},
+        {"leaderboard_sort", bench_leaderboard_sort}};
+    int size_count = sizeof(sizes) / sizeof(sizes[0]);
+    int enemy_count = sizeof(enemy_counts) / sizeof(enemy_counts[0]);
+    int board_count = sizeof(board_sizes) / sizeof(board_sizes[0]);
+    int game_kernel_count = sizeof(game_kernels) / sizeof(game_kernels[0]);
+    int board_kernel_count = sizeof(board_kernels) / sizeof(board_kernels[0]);
+
+    FILE *out = strcmp(path, "-") == 0 ? stdout : fopen(path, "w");
+    if (!out)
+    {
+        fprintf(stderr, "Could not open benchmark output '%s'\n", path);
+        return 1;
+    }
+    fprintf(out, "{\n  \"seed\": %d,\n  \"batches\": %d,\n  \"results\": [", BENCH_SEED, BENCH_BATCHES);
+    bool first = true;
+    bool ok = true;
+
+    for (int s = 0; s < size_count && ok; s++)
+    {
+        int filled = -1;
+        for (int e = 0; e < enemy_count && ok; e++)
+        {
+            // Skip counts the map has no room for; they would repeat the last case
+            Game *probe = create_bench_game(sizes[s][0], sizes[s][1], enemy_counts[e]);
+            ok = probe != NULL;
+            int count = probe ? probe->enemies.count : 0;
+            destroy_game(probe);
+            if (count == filled)
+                continue;
+            filled = count;
+
+            for (int k = 0; k < game_kernel_count && ok; k++)
+            {
+                BenchContext context = {0};
+                context.game = create_bench_game(sizes[s][0], sizes[s][1], enemy_counts[e]);
+                context.copy = create_bench_game(sizes[s][0], sizes[s][1], 0);
+                context.payload = (ByteWriter){NULL, 0, 0, true};
+                ok = context.game && context.copy;
+                if (ok)
+                {
+                    char params[128];
+                    snprintf(params, sizeof(params), "\"width\": %d, \"height\": %d, \"enemies\": %d", sizes[s][0],
+                             sizes[s][1], context.game->enemies.count);
+                    BenchResult result = time_bench_kernel(&game_kernels[k], &context);
+                    report_bench_result(out, &first, &result, params);
+                }
+                destroy_game(context.game);
+                destroy_game(context.copy);
+                free(context.payload.data);
+            }
+        }
+    }
+
+    for (int b = 0; b < board_count && ok; b++)
+    {
+        Leaderboard snapshot = {.root = -1};
+        fill_bench_leaderboard(&snapshot, board_sizes[b]);
+        ok = snapshot.count == board_sizes[b] && write_leaderboard_file(&snapshot, BENCH_LEADERBOARD_PATH);
+        free_leaderboard(&snapshot);
+        for (int k = 0; k < board_kernel_count && ok; k++)
+        {
+            BenchContext context = {0};
+            context.board = (Leaderboard){.root = -1};
+            fill_bench_leaderboard(&context.board, board_sizes[b]);
+            char params[64];
+            snprintf(params, sizeof(params), "\"entries\": %d", board_sizes[b]);
+            BenchResult result = time_bench_kernel(&board_kernels[k], &context);
+            report_bench_result(out, &first, &result, params);
+            free_leaderboard(&context.board);
+        }
+    }
+
+    fprintf(out, "\n  ]\n}\n");
+    remove(BENCH_SAVE_PATH);
+    remove(BENCH_LEADERBOARD_PATH);
+    if (out != stdout)
+        ok = fclose(out) == 0 && ok;
+    if (!ok)
+        fprintf(stderr, "Benchmark run failed\n");
+    return ok ? 0 : 1;
+}
 
+// Replay implementations
+// Keys that do not move the player all play the same idle turn
+char replay_key(char ch) // Function definition
+{
+    return (ch == 'w' || ch == 'a' || ch == 's' || ch == 'd' || ch == 't') ? ch : ' ';
+}
+
+// Keyframe: tag, then a save (header and payload) whose payload starts with what a save
+// leaves out: turn and death bookkeeping, the tick mode and the rules the run was played with.
+// Occupancy, masks and flow are rebuilt by decode_save() rather than stored.
+bool write_snapshot(FILE *file, Game *game) // Function definition
+{
+    ByteWriter payload = {NULL, 0, 0, true};
+    uint8_t cause = !game->death_cause ? 0 : strcmp(game->death_cause, "boss") == 0 ? 2 : 1;
+    const Balance *balance = &game->balance;
+    uint32_t progress_rate;
+    uint64_t xp_growth;
+    memcpy(&progress_rate, &balance->progress_rate, sizeof(progress_rate));
+    memcpy(&xp_growth, &balance->xp_growth, sizeof(xp_growth));
+    write_u64(&payload, (uint64_t)game->turn_count);
+    write_u64(&payload, (uint64_t)game->death_turn);
+    write_u8(&payload, cause);
+    write_u8(&payload, game->hit_by_boss);
+    write_u8(&payload, game->realtime);
+    write_u32(&payload, (uint32_t)game->max_enemies);
+    int32_t rules[] = {balance->boss_hp, balance->boss_hp_rate, balance->boss_strength,
+                       balance->boss_strength_rate, balance->boss_xp, balance->boss_xp_rate};
+    write_u32(&payload, progress_rate);
+    for (size_t i = 0; i < sizeof(rules) / sizeof(rules[0]); i++)
+        write_u32(&payload, (uint32_t)rules[i]);
+    write_u64(&payload, xp_growth);
+    encode_save(&payload, game);
+
+    unsigned char header[SAVE_HEADER_SIZE];
+    encode_save_header(header, &payload);
+    bool success = payload.ok && fputc(REPLAY_KEYFRAME_TAG, file) != EOF &&
+                   fwrite(header, 1, sizeof(header), file) == sizeof(header) &&
+                   fwrite(payload.data, 1, payload.length, file) == payload.length;
+    free(payload.data);
+    return success;
+}
+
+// Reads a keyframe's save header and returns its payload length, or -1 when the header is cut
+// short or claims more bytes than the file has left (so nothing is allocated or skipped for it)
+long read_snapshot_header(FILE *file, long file_length, unsigned char *header) // Function definition
+{
+    if (fread(header, 1, SAVE_HEADER_SIZE, file) != SAVE_HEADER_SIZE)
+        return -1;
+    ByteReader fields = {header, SAVE_HEADER_SIZE, 8, true}; // Payload length follows magic and version
+    uint32_t length = read_u32(&fields);
+    long position = ftell(file);
+    return position >= 0 && length <= (unsigned long)(file_length - position) ? (long)length : -1;
+}
+
+// Reads the keyframe after its tag into game, resizing its grid to the recorded map size;
+// headless comes from the replayer, everything else from the recording
+bool read_snapshot(FILE *file, long file_length, Game *game) // Function definition
+{
+    unsigned char header[SAVE_HEADER_SIZE];
+    long length = read_snapshot_header(file, file_length, header);
+    if (length < 0)
+        return false;
+    unsigned char *data = malloc(SAVE_HEADER_SIZE + (size_t)length);
+    if (!data)
+        return false;
+    memcpy(data, header, sizeof(header));
+
+    ByteReader payload;
+    bool success = fread(data + SAVE_HEADER_SIZE, 1, length, file) == (size_t)length &&
+                   check_save_header(data, SAVE_HEADER_SIZE + (size_t)length, &payload);
+    long turn_count = 0;
+    long death_turn = -1;
+    uint8_t cause = 0;
+    bool hit_by_boss = false;
+    bool realtime = false;
+    int max_enemies = 0;
+    Balance balance;
     if (success)
     {
-        // printf("DEBUG: Game saved successfully\n");
-        //  Verify the file exists
-        file = fopen(path, "rb");
-        // printf("DEBUG: Save file verification: %s\n", file ? "SUCCESS" : "FAILED");
-        if (file)
-            fclose(file);
+        turn_count = (long)read_u64(&payload);
+        death_turn = (long)read_u64(&payload);
+        cause = read_u8(&payload);
+        hit_by_boss = read_u8(&payload) != 0;
+        realtime = read_u8(&payload) != 0;
+        max_enemies = (int32_t)read_u32(&payload);
+        uint32_t progress_rate = read_u32(&payload);
+        int *rules[] = {&balance.boss_hp, &balance.boss_hp_rate, &balance.boss_strength,
+                        &balance.boss_strength_rate, &balance.boss_xp, &balance.boss_xp_rate};
+        for (size_t i = 0; i < sizeof(rules) / sizeof(rules[0]); i++)
+            *rules[i] = (int32_t)read_u32(&payload);
+        uint64_t xp_growth = read_u64(&payload);
+        memcpy(&balance.progress_rate, &progress_rate, sizeof(progress_rate));
+        memcpy(&balance.xp_growth, &xp_growth, sizeof(xp_growth));
+        success = payload.ok && turn_count >= 0 && cause <= 2 && max_enemies >= 0;
     }
-    else
+    if (success)
     {
-        // printf("DEBUG: Failed to write save data\n");
+        game->max_enemies = max_enemies;
+        game->balance = balance;
+        success = decode_save(&payload, game);
+    }
+    free(data);
+    if (!success)
+        return false;
+
+    game->turn_count = turn_count;
+    game->death_turn = death_turn;
+    game->death_cause = cause == 0 ? NULL : cause == 2 ? "boss" : "enemy";
+    game->hit_by_boss = hit_by_boss;
+    game->realtime = realtime;
+    return true;
+}
+
+bool skip_snapshot(FILE *file, long file_length) // Function definition
+{
+    unsigned char header[SAVE_HEADER_SIZE];
+    long length = read_snapshot_header(file, file_length, header);
+    return length >= 0 && fseek(file, length, SEEK_CUR) == 0;
+}
+
+// Compares the state a replay re-simulated with the keyframe recorded at the same turn. The
+// keyframe was decoded from a save, so the map goes row by row and its stream is the scroll front's.
+bool snapshots_match(Game *a, Game *b) // Function definition
+{
+    if (a->turn_count != b->turn_count || a->world_offset != b->world_offset || a->furthest_offset != b->furthest_offset ||
+        a->move_count != b->move_count ||
+        a->player.x != b->player.x || a->player.y != b->player.y ||
+        a->player.hp != b->player.hp || a->player.xp != b->player.xp ||
+        a->player.score != b->player.score || a->player.level != b->player.level ||
+        a->enemies.count != b->enemies.count ||
+        memcmp(map_stream_front(a), map_stream_front(b), sizeof(Rng)) != 0 || // The policy stream belongs to the input side
+        memcmp(&a->rng.spawn, &b->rng.spawn, sizeof(Rng)) != 0 ||
+        memcmp(&a->rng.ai, &b->rng.ai, sizeof(Rng)) != 0 ||
+        a->width != b->width || a->height != b->height)
+        return false;
+    for (int y = 0; y < a->height; y++)
+    {
+        if (memcmp(map_row(a, y), map_row(b, y), a->width) != 0)
+            return false;
+    }
+    for (int i = 0; i < a->enemies.count; i++)
+    {
+        const Enemy *ea = &a->enemies.items[i];
+        const Enemy *eb = &b->enemies.items[i];
+        if (ea->x != eb->x || ea->y != eb->y || ea->hp != eb->hp || ea->is_boss != eb->is_boss)
+            return false;
     }
-
-    return success;
+    return true;
 }
 
-bool load_game(GameData *data)
-{ // Function definition
-    char *path = get_save_file_path();
-    FILE *file = fopen(path, "rb");
-    if (!file)
-    {
-        return false;
-    }
+// Opens a fresh replay for the run in game; the previous replay at path is kept as path.prev
+bool start_recording(ReplayRecorder *recorder, const char *path, Game *game) // Function definition
+{
+    stop_recording(recorder);
+    char previous[300];
+    snprintf(previous, sizeof(previous), "%s.prev", path);
+    safe_rename(path, previous);
 
-    bool success = fread(data, sizeof(GameData), 1, file) == 1;
-    fclose(file);
+    recorder->file = fopen(path, "wb");
+    if (!recorder->file)
+        return false;
+    if (recorder->keyframe_interval <= 0)
+        recorder->keyframe_interval = REPLAY_KEYFRAME_INTERVAL;
+    recorder->keyframes = 0;
 
-    if (success && data->player.hp <= 0)
+    ReplayHeader header = {{'R', 'B', 'R', 'P'}, REPLAY_VERSION, (uint32_t)recorder->keyframe_interval};
+    if (fwrite(&header, sizeof(header), 1, recorder->file) != 1 || !write_snapshot(recorder->file, game))
     {
-        remove(path);
+        fclose(recorder->file);
+        recorder->file = NULL;
         return false;
     }
-    return success;
+    recorder->keyframes++;
+    return true;
 }
 
-bool save_file_exists()
-{ // Function definition
-    FILE *file = fopen(get_save_file_path(), "rb");
-    if (file)
+// Appends the turn just played, and a keyframe when the interval is due
+void record_turn(ReplayRecorder *recorder, Game *game, char ch) // Function definition
+{
+    if (!recorder->file)
+        return;
+    profile_begin();
+    fputc(replay_key(ch), recorder->file);
+    if (game->turn_count % recorder->keyframe_interval == 0)
     {
-        // Verify it contains valid data
-        GameData test;
-        bool valid = fread(&test, sizeof(GameData), 1, file) == 1;
-        fclose(file);
-        return valid;
+        write_snapshot(recorder->file, game);
+        recorder->keyframes++;
     }
-    return false;
+    profile_end(PHASE_FILE_IO);
 }
 
-// Game flow implementations
-void game_over() // Function definition
+void stop_recording(ReplayRecorder *recorder) // Function definition
 {
-    clear_screen();
-#ifdef _WIN32
-    move_cursor(MAP_WIDTH / 2 - 15, MAP_HEIGHT / 2 - 1);
-    printf("================================");
-    move_cursor(MAP_WIDTH / 2 - 15, MAP_HEIGHT / 2);
-    printf("        GAME OVER!             ");
-    move_cursor(MAP_WIDTH / 2 - 15, MAP_HEIGHT / 2 + 1);
-    printf("  Final Score: %-10d      ", player.score);
-    move_cursor(MAP_WIDTH / 2 - 15, MAP_HEIGHT / 2 + 2);
-    printf("================================");
-#else
-    move_cursor(MAP_WIDTH / 2 - 15, MAP_HEIGHT / 2 - 1);
-    printf("\033[1;31m╔══════════════════════════╗\033[0m");
-    move_cursor(MAP_WIDTH / 2 - 15, MAP_HEIGHT / 2);
-    printf("\033[1;31m║      GAME OVER!          ║\033[0m");
-    move_cursor(MAP_WIDTH / 2 - 15, MAP_HEIGHT / 2 + 1);
-    printf("\033[1;31m║ Final Score: %-10d  ║\033[0m", player.score);
-    move_cursor(MAP_WIDTH / 2 - 15, MAP_HEIGHT / 2 + 2);
-    printf("\033[1;31m╚══════════════════════════╝\033[0m");
-#endif
-    fflush(stdout);
-
-    add_to_leaderboard();
-
-    // Clean up save file
-    char *save_path = get_save_file_path();
-    remove(save_path);
-
-    msleep(3000);
+    if (!recorder->file)
+        return;
+    fclose(recorder->file);
+    recorder->file = NULL;
 }
 
-void get_player_name() // Function definition
+// Re-simulates a recorded run, checking every keyframe on the way. With a rate the game is
+// drawn at that many turns per second (q stops); without one it runs flat out and reports.
+int run_replay(const ReplayConfig *config) // Function definition
 {
-#ifndef _WIN32
-    struct termios oldt, newt;
-    tcgetattr(STDIN_FILENO, &oldt);
-    newt = oldt;
-    newt.c_lflag |= ECHO | ICANON;
-    tcsetattr(STDIN_FILENO, TCSANOW, &newt);
-#endif
-
-    clear_screen();
-    printf("Enter your name (max 50 chars): ");
-    fflush(stdout);
-
-    char input[51];
-    if (fgets(input, 51, stdin))
+    FILE *file = fopen(config->path, "rb");
+    if (!file)
     {
-        input[strcspn(input, "\n")] = '\0';
-        if (strlen(input) > 0)
-        {
-            strncpy(player.name, input, 50);
-            player.name[50] = '\0';
-        }
+        fprintf(stderr, "Could not open replay '%s'\n", config->path);
+        return 1;
     }
 
-#ifndef _WIN32
-    tcsetattr(STDIN_FILENO, TCSANOW, &oldt);
-#endif
-}
+    ReplayHeader header;
+    if (fread(&header, sizeof(header), 1, file) != 1 || memcmp(header.magic, "RBRP", 4) != 0 ||
+        header.version != REPLAY_VERSION)
+    {
+        fprintf(stderr, "'%s' is not a replay this build can play\n", config->path);
+        fclose(file);
+        return 1;
+    }
+    // Keyframe lengths are checked against what is left of the file before anything is read
+    long data_start = ftell(file);
+    fseek(file, 0, SEEK_END);
+    long file_length = ftell(file);
+    fseek(file, data_start, SEEK_SET);
+
+    bool render = config->rate > 0;
+    Game *game = create_game(true);
+    Game *check = create_game(true);
+    if (!game || !check || fgetc(file) != REPLAY_KEYFRAME_TAG || !read_snapshot(file, file_length, game))
+    {
+        fprintf(stderr, "Replay '%s' has no starting keyframe\n", config->path);
+        destroy_game(game);
+        destroy_game(check);
+        fclose(file);
+        return 1;
+    }
 
-void handle_movement(int dx, int dy) // Function definition
-{
-    bool boss_alive = false;
-    for (int i = 0; i < enemy_count; i++)
+    // Seek: jump to the last keyframe at or before the target turn, found by scanning the
+    // record bytes, so only the turns after it have to be simulated
+    if (config->seek_turn > game->turn_count)
     {
-        if (enemies[i].is_boss)
+        long start_offset = ftell(file);
+        long best_offset = -1;
+        long turn = game->turn_count;
+        bool damaged = false;
+        int c;
+        while (turn <= config->seek_turn && (c = fgetc(file)) != EOF)
         {
-            boss_alive = true;
-            break;
+            if (c == REPLAY_KEYFRAME_TAG)
+            {
+                long offset = ftell(file);
+                if (!skip_snapshot(file, file_length))
+                {
+                    damaged = true;
+                    break;
+                }
+                best_offset = offset;
+            }
+            else
+            {
+                turn++;
+            }
+        }
+        fseek(file, best_offset >= 0 ? best_offset : start_offset, SEEK_SET);
+        if (damaged || (best_offset >= 0 && !read_snapshot(file, file_length, game)))
+        {
+            fprintf(stderr, "Replay '%s' has a damaged keyframe\n", config->path);
+            destroy_game(game);
+            destroy_game(check);
+            fclose(file);
+            return 1;
         }
     }
 
-    int new_x = player.x + dx;
-    int new_y = player.y + dy;
-
-    if (new_x < 0 || new_x >= MAP_WIDTH || new_y < 0 || new_y >= MAP_HEIGHT)
-        return;
-
-    if (game_map[new_y][new_x] == '_')
+    const char *end_reason = "end of recording";
+    long simulated = 0;
+    long keyframes_checked = 0;
+    int status = 0;
+    double start = now_seconds();
+    double next_turn = start; // When the next drawn turn is due at --speed
+    int c;
+    while ((c = fgetc(file)) != EOF)
     {
-        player.x = new_x;
-        player.y = new_y;
-
-        // Only shift world if not in boss room or boss is dead
-        if (dy < 0 && (!boss_alive || !((world_offset > 200) && (world_offset % 200 == 0))))
+        if (c == REPLAY_KEYFRAME_TAG)
         {
-            update_score();
-            if (player.y < MAP_HEIGHT / 4)
+            if (!read_snapshot(file, file_length, check))
             {
-                shift_world_down();
+                end_reason = "damaged keyframe";
+                status = 1;
+                break;
+            }
+            if (!snapshots_match(game, check))
+            {
+                fprintf(stderr, "Replay diverged from the recording at turn %ld\n", check->turn_count);
+                end_reason = "desync";
+                status = 2;
+                break;
             }
+            keyframes_checked++;
+            continue;
         }
 
-        move_enemies();
-        check_collisions();
+        // Catch up to the seek target without drawing or pausing
+        bool visible = render && game->turn_count >= config->seek_turn;
+        game->headless = !visible;
+        play_turn(game, (char)c);
+        simulated++;
 
-        if (++move_count % 20 == 0)
+        if (visible)
+        {
+            // Wait out the turn in poll(), so q stops playback at once
+            draw_game(game);
+            next_turn = (next_turn > now_seconds() ? next_turn : now_seconds()) + 1.0 / config->rate;
+            int key = 0;
+            while (!poll_key(&key) && now_seconds() < next_turn)
+            {
+                pump_input((int)((next_turn - now_seconds()) * 1000.0 + 0.999));
+            }
+            if (tolower(key_to_char(key)) == 'q')
+            {
+                end_reason = "stopped";
+                break;
+            }
+        }
+        if (game->player.hp <= 0)
         {
-            spawn_enemies();
+            end_reason = "died";
+            break;
         }
     }
+    double elapsed = now_seconds() - start;
+    fclose(file);
+
+    if (render)
+    {
+        move_cursor(0, screen_height + 1);
+        end_frame();
+        restore_terminal();
+    }
+    printf("replay=%s keyframes_checked=%ld\n", config->path, keyframes_checked);
+    report_run(game, end_reason, simulated, elapsed);
+    destroy_game(game);
+    destroy_game(check);
+    return status;
 }
 
-void game_loop() // Function definition
+void print_usage(const char *program) // Function definition
 {
-    GameState state = MAIN_MENU;
-    // Different states of the game (menu, playing, game over, etc.)
-    GameData game_data;
-    bool has_save = save_file_exists();
+    fprintf(stderr, "Usage: %s [--seed N] [--sink stdout|null|memory|file:PATH] [--sink-stats]\n"
+                    "       %s --headless [--seed N] [--random | --script PATH | --stdin] [--turns N]\n"
+                    "       %s --simulate GAMES [--threads N] [--seed N] [--turns N]\n"
+                    "       %s --replay PATH [--speed TURNS_PER_SEC] [--seek TURN]\n"
+                    "       %s --bench PATH|-\n"
+                    "Any mode also accepts --balance NAME=VALUE (progress_rate, boss_hp, boss_hp_rate,\n"
+                    "boss_strength, boss_strength_rate, boss_xp, boss_xp_rate, xp_growth).\n"
+                    "Games record to last_run.rbr (or --record PATH, headless only with it; --no-record\n"
+                    "disables) with a keyframe every --keyframe-interval N turns.\n"
+                    "Games autosave only when asked: every --autosave N turns (50 when only seconds are\n"
+                    "given) and/or every --autosave-seconds S; --autosave-stats prints writer and stall\n"
+                    "times on exit.\n"
+                    "Any mode also accepts --map-width N, --map-height N (default 40x12, at least 16x8)\n"
+                    "and --max-enemies N (default 25); the screen shows a viewport that follows the player.\n"
+                    "Rows behind the map are kept in chunks, at most --chunk-budget KB (default 256) in\n"
+                    "memory and the rest in a temporary file; --chunk-stats prints store counts after\n"
+                    "headless runs.\n"
+                    "--realtime HZ moves enemies HZ times a second instead of once per key, drawing up to\n"
+                    "--fps N frames a second (default 30; headless runs play one key per tick);\n"
+                    "--tick-stats prints tick and frame times on exit.\n"
+                    "--profile (or ROGUEBYTE_PROFILE=1) times each phase of a turn and prints per-phase\n"
+                    "p50/p90/p99/max and call counts on exit.\n"
+                    "--bench times the core game kernels at fixed seeds over several map sizes, enemy\n"
+                    "counts and leaderboard sizes and writes the results as JSON to PATH (- = stdout).\n"
+                    "--spectate tcp:PORT|unix:PATH streams every frame the game draws to spectators on a\n"
+                    "loopback port or Unix socket (watch with e.g. nc localhost PORT): a full frame on\n"
+                    "joining, then only the cells that change. --spectate-check draws the first frame of\n"
+                    "a run (--seed) to a file sink and to a loopback spectator and checks they match.\n",
+            program, program, program, program, program);
+}
 
-    show_welcome_screen();
-    load_leaderboard();
+void shutdown_render_sink() // Function definition
+{
+    end_frame();
+    if (report_sink_stats || strcmp(render_sink.name, "stdout") != 0)
+        report_render_sink(stderr);
+    close_render_sink();
+}
 
-    while (1)
+int main(int argc, char *argv[]) // Main function: entry point of the game
+{
+    const char *sink_spec = "stdout";
+    bool headless = false;
+    long simulate_games = 0;
+    const char *bench_path = NULL;
+    const char *spectate_spec = NULL;
+    bool spectate_check = false;
+    int simulate_threads = 0;
+    balance_option = default_balance;
+    ReplayConfig replay_config = {NULL, 0, 0};
+    HeadlessConfig headless_config = {INPUT_RANDOM, NULL, HEADLESS_DEFAULT_TURNS};
+    for (int i = 1; i < argc; i++)
     {
-        // Always check for save file when returning to menu
-        if (state == MAIN_MENU)
+        if (strcmp(argv[i], "--sink") == 0 && i + 1 < argc)
         {
-            has_save = save_file_exists();
+            sink_spec = argv[++i];
         }
-
-        switch (state)
+        else if (strcmp(argv[i], "--headless") == 0)
         {
-        case MAIN_MENU:
+            headless = true;
+        }
+        else if (strcmp(argv[i], "--simulate") == 0 && i + 1 < argc)
         {
-            int choice = show_main_menu(has_save);
-            if (choice == 0 && has_save)
-            { // Continue
-                if (load_game(&game_data))
-                {
-                    // Copy loaded data to game state
-                    player = game_data.player;
-                    memcpy(enemies, game_data.enemies, sizeof(enemies));
-                    enemy_count = game_data.enemy_count;
-                    memcpy(game_map, game_data.game_map, sizeof(game_map));
-                    world_offset = game_data.world_offset;
-                    move_count = game_data.move_count;
-                    state = IN_GAME;
-                }
-            }
-            else if (choice == 1) // Function definition
-            {                     // New Game
-                // Delete any existing save file when starting new game
-                char *save_path = get_save_file_path();
-                remove(save_path);
-
-                get_player_name();
-                init_player();
-                init_map();
-                enemy_count = 0;
-                world_offset = 0;
-                move_count = 0;
-                spawn_enemies();
-                state = IN_GAME;
-            }
-            else if (choice == 2) // Function definition
-            {                     // Leaderboard
-                state = LEADERBOARD;
-            }
-            else
-            { // Exit
-                return;
-            }
-            break;
+            simulate_games = atol(argv[++i]);
         }
-
-        case IN_GAME:
+        else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
         {
-            // Check for death before processing anything else
-            if (player.hp <= 0)
+            simulate_threads = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--balance") == 0 && i + 1 < argc)
+        {
+            if (!set_balance_option(&balance_option, argv[++i]))
             {
-                state = GAME_OVER;
-                break;
-            }
-
-            draw_game();
-            char ch = tolower(getch());
-
-            if (ch == 'p')
-            { // Save game
-                GameData save;
-                save.player = player;
-                memcpy(save.enemies, enemies, sizeof(enemies));
-                save.enemy_count = enemy_count;
-                memcpy(save.game_map, game_map, sizeof(game_map));
-                save.world_offset = world_offset;
-                save.move_count = move_count;
-
-                if (save_game(&save))
-                {
-                    display_message("Game saved!", MSG_LINE_1, true);
-                    draw_game();
-                    state = MAIN_MENU;
-                }
-                else
-                {
-                    display_message("Save failed!", MSG_LINE_1, true);
-                    draw_game();
-                }
+                fprintf(stderr, "Unknown or invalid balance setting '%s'\n", argv[i]);
+                return 1;
             }
-            else if (ch == 'q') // Function definition
-            {                   // Quit to menu
-                state = MAIN_MENU;
-            }
-            else
-            { // Handle movement
-                switch (ch)
-                {
-                case 'w':
-                    handle_movement(0, -1);
-                    break;
-                case 'a':
-                    handle_movement(-1, 0);
-                    break;
-                case 's':
-                    handle_movement(0, 1);
-                    break;
-                case 'd':
-                    handle_movement(1, 0);
-                    break;
-                }
-
-                // Process enemy movement and collisions after player moves
-                move_enemies();
-                check_collisions();
-
-                // Spawn new enemies periodically
-                if (++move_count % 20 == 0)
-                {
-                    spawn_enemies();
-                }
+        }
+        else if ((strcmp(argv[i], "--map-width") == 0 || strcmp(argv[i], "--map-height") == 0 ||
+                  strcmp(argv[i], "--max-enemies") == 0) && i + 1 < argc)
+        {
+            if (!set_world_option(&world_option, argv[i], argv[i + 1]))
+            {
+                fprintf(stderr, "Invalid value '%s' for %s\n", argv[i + 1], argv[i]);
+                return 1;
             }
-            break;
+            i++;
         }
-
-        case GAME_OVER:
+        else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc)
         {
-            game_over();
-            state = LEADERBOARD;
-            break;
+            replay_config.path = argv[++i];
+        }
+        else if (strcmp(argv[i], "--speed") == 0 && i + 1 < argc)
+        {
+            replay_config.rate = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--seek") == 0 && i + 1 < argc)
+        {
+            replay_config.seek_turn = atol(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc)
+        {
+            record_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "--no-record") == 0)
+        {
+            record_enabled = false;
+        }
+        else if (strcmp(argv[i], "--keyframe-interval") == 0 && i + 1 < argc)
+        {
+            keyframe_interval_option = atol(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--autosave") == 0 && i + 1 < argc)
+        {
+            autosave_turns = atol(argv[++i]);
+            autosave_option_set = true;
+        }
+        else if (strcmp(argv[i], "--autosave-seconds") == 0 && i + 1 < argc)
+        {
+            autosave_seconds = atof(argv[++i]);
+            autosave_option_set = true;
+        }
+        else if (strcmp(argv[i], "--autosave-stats") == 0)
+        {
+            report_autosave_stats = true;
+        }
+        else if (strcmp(argv[i], "--chunk-budget") == 0 && i + 1 < argc)
+        {
+            chunk_budget_kb = atol(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--chunk-stats") == 0)
+        {
+            report_chunk_stats = true;
+        }
+        else if (strcmp(argv[i], "--realtime") == 0 && i + 1 < argc)
+        {
+            realtime_tick_rate = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--fps") == 0 && i + 1 < argc)
+        {
+            realtime_frame_rate = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--tick-stats") == 0)
+        {
+            report_tick_stats = true;
         }
+        else if (strcmp(argv[i], "--profile") == 0)
+        {
+            profiling = true;
+        }
+        else if (strcmp(argv[i], "--bench") == 0 && i + 1 < argc)
+        {
+            bench_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "--spectate") == 0 && i + 1 < argc)
+        {
+            spectate_spec = argv[++i];
+        }
+        else if (strcmp(argv[i], "--spectate-check") == 0)
+        {
+            spectate_check = true;
+        }
+        else if (strcmp(argv[i], "--random") == 0)
+        {
+            headless_config.input = INPUT_RANDOM;
+        }
+        else if (strcmp(argv[i], "--script") == 0 && i + 1 < argc)
+        {
+            headless_config.input = INPUT_SCRIPT;
+            headless_config.script_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "--stdin") == 0)
+        {
+            headless_config.input = INPUT_STDIN;
+        }
+        else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc)
+        {
+            seed_option = strtoull(argv[++i], NULL, 0);
+            seed_option_set = true;
+        }
+        else if (strcmp(argv[i], "--turns") == 0 && i + 1 < argc)
+        {
+            headless_config.max_turns = atol(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--sink-stats") == 0)
+        {
+            report_sink_stats = true;
+        }
+        else
+        {
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+    if (realtime_tick_rate < 0 || realtime_frame_rate <= 0)
+    {
+        print_usage(argv[0]);
+        return 1;
+    }
+    const char *profile_env = getenv("ROGUEBYTE_PROFILE");
+    if (profile_env && *profile_env && strcmp(profile_env, "0") != 0)
+        profiling = true;
+    if (profiling && simulate_games > 0)
+    {
+        fprintf(stderr, "--profile times one game at a time and is ignored with --simulate\n");
+        profiling = false;
+    }
+    if (profiling)
+        atexit(report_profile); // First registered, so it prints after the terminal is restored
+    if (spectate_check)
+        return run_spectator_check();
+    if (spectate_spec)
+    {
+        if (!start_spectator_server(spectate_spec))
+        {
+            fprintf(stderr, "Could not listen for spectators on '%s'\n", spectate_spec);
+            return 1;
+        }
+        atexit(stop_spectator_server);
+    }
 
-        case LEADERBOARD:
+    if (replay_config.path)
+    {
+        if (replay_config.rate <= 0)
         {
-            show_leaderboard();
-            state = MAIN_MENU;
-            break;
+            open_render_sink("null");
+            return run_replay(&replay_config);
         }
+        if (!open_render_sink(sink_spec))
+        {
+            fprintf(stderr, "Could not open render sink '%s'\n", sink_spec);
+            return 1;
         }
+        enable_raw_mode();
+#ifdef _WIN32
+        enable_ansi();
+#endif
+        query_terminal_size();
+        clear_screen();
+        int status = run_replay(&replay_config);
+        close_render_sink();
+        return status;
     }
-}
 
-// dbugging
-//  void debug_game_state() {
-//      printf("\nDEBUG: Game State\n");
-//      printf("Player: %s (HP: %d/%d)\n", player.name, player.hp, player.max_hp);
-//      printf("Score: %d, Level: %d\n", player.score, player.level);
-//      printf("Save exists: %s\n", save_file_exists() ? "YES" : "NO");
+    if (bench_path)
+    {
+        open_render_sink("null");
+        return run_benchmarks(bench_path);
+    }
 
-//     FILE *lb = fopen(get_leaderboard_path(), "r");
-//     printf("Leaderboard exists: %s\n", lb ? "YES" : "NO");
-//     if (lb) fclose(lb);
-// }
-int main() // Main function: entry point of the game
-{
-    srand(time(NULL));
+    if (simulate_games > 0)
+    {
+        return run_simulation(simulate_games, simulate_threads, headless_config.max_turns);
+    }
+
+    if (headless)
+    {
+        open_render_sink("null");
+        return run_headless(&headless_config);
+    }
+
+    if (!open_render_sink(sink_spec))
+    {
+        fprintf(stderr, "Could not open render sink '%s'\n", sink_spec);
+        return 1;
+    }
+    atexit(shutdown_render_sink);
+    atexit(finish_leaderboard_compaction);
+    if (autosave_option_set)
+        start_autosave();
+    atexit(stop_autosave);
+    enable_raw_mode();
+    query_terminal_size();
 
 #ifdef _WIN32
     enable_ansi();
 #endif
 
     game_loop();
+    if (report_tick_stats && realtime_tick_rate > 0)
+        report_realtime(stderr);
     return 0;
-}
\ No newline at end of file
+}